@@ -0,0 +1,149 @@
+"""
+# Measure the throughput of the `ipq` queries using synthetic instrumented images.
+
+# Programs with a given number of functions, files, and regions per function are
+# generated, compiled with coverage instrumentation, and executed to produce profiles.
+# Each query is then timed using the statistics written by `ipq -s`.
+
+# Usage: `benchmark.py work-directory llvm-config ipq-executable [functions:files:regions]...`
+"""
+import os
+import json
+import subprocess
+
+from fault.system import files
+from fault.system import process
+
+from . import query
+
+# The default scales as (functions, files, regions per function).
+scales = [
+	(1000, 10, 8),
+	(10000, 100, 8),
+	(50000, 500, 16),
+]
+
+# Queries and the options they are timed with.
+queries = [
+	('sources', ()),
+	('regions', ()),
+	('regions', ('-F', 'binary')),
+	('regions', ('-F', 'indexed')),
+	('counters', ()),
+	('counters', ('-F', 'binary')),
+	('export', ()),
+]
+
+def function_source(name, regions):
+	"""
+	# Generate a function with approximately &regions code regions.
+	# Every conditional contributes a condition, a body, and a gap region.
+	"""
+	lines = ['int', name + '(int x)', '{', '\tint r = 0;']
+	for i in range(max(1, regions // 3)):
+		lines.append('\tif (x & %d) r += %d;' % (1 << (i % 16), i + 1))
+	lines.append('\treturn r;')
+	lines.append('}')
+	return '\n'.join(lines) + '\n'
+
+def generate(route, functions, nfiles, regions):
+	"""
+	# Write the sources of a synthetic program to the &route directory.
+	# Returns the list of source paths.
+	"""
+	route.fs_alloc().fs_mkdir()
+	per_file = max(1, functions // nfiles)
+	sources = []
+	declarations = []
+
+	for f in range(nfiles):
+		names = ['f_%d_%d' % (f, n) for n in range(per_file)]
+		declarations.extend(names)
+		src = route/('unit%d.c' % (f,))
+		src.fs_store('\n'.join(function_source(x, regions) for x in names).encode('utf-8'))
+		sources.append(str(src))
+
+	# Execute every other function so that both counted and uncounted regions are present.
+	main = ['int %s(int);' % (x,) for x in declarations]
+	main.append('int main(int argc, char *argv[])\n{\n\tint r = 0;')
+	main.extend('\tr += %s(argc + %d);' % (x, i) for i, x in enumerate(declarations) if i % 2 == 0)
+	main.append('\treturn(r == 0);\n}\n')
+	src = route/'main.c'
+	src.fs_store('\n'.join(main).encode('utf-8'))
+	sources.append(str(src))
+
+	return sources
+
+def build(route, cc, merge, sources):
+	"""
+	# Compile, execute, and merge the profile of the program in &route.
+	# Returns the image and indexed profile paths.
+	"""
+	image = route/'image'
+	raw = route/'image.profraw'
+	profile = route/'image.profdata'
+
+	subprocess.run([cc, '-O0', '-fprofile-instr-generate', '-fcoverage-mapping', '-o', str(image)] + sources, check=True)
+	env = dict(os.environ)
+	env['LLVM_PROFILE_FILE'] = str(raw)
+	subprocess.run([str(image)], env=env, check=True)
+	subprocess.run([merge, 'merge', '-sparse', '-o', str(profile), str(raw)], check=True)
+
+	return str(image), str(profile)
+
+def measure(ipq, route, arch, image, profile, name, options):
+	"""
+	# Execute a query, discarding its output, and return the statistics it reported.
+	"""
+	statistics = route/'statistics.json'
+	command = [ipq, '-s', str(statistics)] + list(options) + [name, arch, image]
+	if name in ('counters', 'export'):
+		command.append(profile)
+
+	subprocess.run(command, stdout=subprocess.DEVNULL, check=True)
+	return json.loads(statistics.fs_load().decode('utf-8'))
+
+def rate(count, elapsed):
+	return (count / elapsed) if elapsed > 0 else 0.0
+
+def report(scale, name, options, s):
+	elapsed = s['elapsed']
+	fields = [
+		'%d:%d:%d' % scale,
+		' '.join((name,) + tuple(options)),
+		'%.3f' % (elapsed,),
+		'%.0f' % rate(s['records'], elapsed),
+		'%.0f' % rate(s['segments'], elapsed),
+		'%.2f' % (rate(s['output_bytes'], elapsed) / (1024*1024),),
+		str(s['peak_rss']),
+	]
+	return '\t'.join(fields)
+
+def main(inv:process.Invocation) -> process.Exit:
+	work, llvmconfig, ipq, *selected = inv.args
+	work = files.Path.from_path(os.path.realpath(work))
+	llvmconfig = files.Path.from_path(llvmconfig)
+
+	v, src, merge, export, ipqd = query.instrumentation(llvmconfig)
+	cc = str(llvmconfig.container/'clang')
+	arch = os.uname().machine
+
+	if selected:
+		selected = [tuple(map(int, x.split(':'))) for x in selected]
+	else:
+		selected = scales
+
+	print('\t'.join(['scale', 'query', 'seconds', 'records/s', 'segments/s', 'MB/s', 'peak-rss']))
+	for scale in selected:
+		route = work/('%d-%d-%d' % scale)
+		sources = generate(route, *scale)
+		image, profile = build(route, cc, merge, sources)
+
+		for name, options in queries:
+			s = measure(ipq, route, arch, image, profile, name, options)
+			print(report(scale, name, options, s), flush=True)
+
+	return inv.exit(0)
+
+if __name__ == '__main__':
+	process.control(main, process.Invocation.system())
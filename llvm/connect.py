@@ -78,6 +78,15 @@ def declare(ipq, deline):
 			['.fault', '.libllvm-is', '.libllvm-if'], [
 				('ipq.cc', ipq['source']),
 			]),
+
+		# Python extension providing the queries in-process; ipqmodule.cc includes ipq.cc,
+		# which is given to the factor as a header so that it is present but not compiled.
+		('ipq',
+			'http://if.fault.io/factors/system.extension',
+			['.fault', '.libllvm-is', '.libllvm-if'], [
+				('ipqmodule.cc', ipq['module']),
+				('ipq.h', ipq['source']),
+			]),
 	]
 
 	return factory.Parameters.define(info, formats, sets=sets, soles=soles)
@@ -86,7 +95,7 @@ def main(inv:process.Invocation) -> process.Exit:
 	target, llvmconfig = inv.args
 	route = files.Path.from_path(os.path.realpath(target))
 
-	# Identify ipq.cc, delineate.c, and json.c
+	# Identify ipq.cc, ipqmodule.cc, delineate.c, and json.c
 	factors.load()
 	factors.configure()
 	pd, pj, fp = factors.split(__name__)
@@ -96,6 +105,7 @@ def main(inv:process.Invocation) -> process.Exit:
 	# Get the libraries and interfaces needed out of &query
 	v, src, merge, export, ipqd = query.instrumentation(files.root@llvmconfig)
 	ipqd['source'] = llvm_factors[llvm_d/'ipq'][0][1]
+	ipqd['module'] = llvm_factors[llvm_d/'ipqmodule'][0][1]
 
 	# Sources of the image factors.
 	deline = (
@@ -4,17 +4,29 @@
 #include <stddef.h>
 #include <limits.h>
 
-#define __STDC_LIMIT_MACROS 1
-#define __STDC_CONSTANT_MACROS 1
+#ifndef __STDC_LIMIT_MACROS
+	#define __STDC_LIMIT_MACROS 1
+#endif
+#ifndef __STDC_CONSTANT_MACROS
+	#define __STDC_CONSTANT_MACROS 1
+#endif
 #define __STDC_FORMAT_MACROS 1
 
 #include <TargetConditionals.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/Optional.h>
 #include <llvm/ADT/SmallBitVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
 
 /*
 	// CounterMappingRegion (mapping stored in binaries)
@@ -27,14 +39,23 @@
 	#include <llvm/ProfileData/Coverage/CoverageMappingReader.h>
 #endif
 
+/*
+	// Multiple images are only supported by the ArrayRef signatures.
+*/
 #if (LLVM_VERSION_MAJOR >= 5)
-	#define CM_LOAD(object, data, arch) coverage::CoverageMapping::load( \
-		makeArrayRef(StringRef(object)), \
+	#define CM_MULTIPLE_IMAGES 1
+	#define CM_LOAD(objects, data, arches) coverage::CoverageMapping::load( \
+		makeArrayRef(objects), \
 		StringRef(data), \
-		StringRef(arch) \
+		makeArrayRef(arches) \
 	)
 #else
-	#define CM_LOAD coverage::CoverageMapping::load
+	#define CM_MULTIPLE_IMAGES 0
+	#define CM_LOAD(objects, data, arches) coverage::CoverageMapping::load( \
+		objects[0], \
+		StringRef(data), \
+		arches[0] \
+	)
 #endif
 
 #if (LLVM_VERSION_MAJOR >= 9)
@@ -56,21 +77,99 @@
 	#define ITER_CR_CLOSE()
 #endif
 
+#if (LLVM_VERSION_MAJOR >= 9)
+	#include <llvm/Demangle/Demangle.h>
+#endif
+
 #include <llvm/ProfileData/InstrProfReader.h>
+#include <llvm/ProfileData/InstrProfWriter.h>
+#include <llvm/Support/Compression.h>
 #include <llvm/Support/Debug.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Object/MachO.h>
+#include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/Errc.h>
 #include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
 #include <system_error>
 #include <tuple>
 #include <iostream>
 #include <set>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 using namespace llvm;
 
+/*
+	// Branch regions were introduced in 12.
+*/
+#if (LLVM_VERSION_MAJOR >= 12)
+	#define BRANCH_REGIONS 1
+#else
+	#define BRANCH_REGIONS 0
+#endif
+
+/*
+	// Raw profile merging; the profile kind interfaces of the writer changed in 14.
+*/
+#if (LLVM_VERSION_MAJOR >= 14)
+	#define RAW_PROFILES 1
+	#define MERGE_PROFILE_KIND(W, R) W.mergeProfileKind(R->getProfileKind())
+#elif (LLVM_VERSION_MAJOR >= 11)
+	#define RAW_PROFILES 1
+	#define MERGE_PROFILE_KIND(W, R) ( \
+		W.setInstrEntryBBEnabled(R->instrEntryBBEnabled()), \
+		W.setIsIRLevelProfile(R->isIRLevelProfile(), R->hasCSIRLevelProfile()) \
+	)
+#else
+	#define RAW_PROFILES 0
+#endif
+
+/*
+	// Chunk compression; the interfaces moved into llvm::compression in 15,
+	// and zstd was added in 16.
+*/
+#if (LLVM_VERSION_MAJOR >= 15)
+	#define COMPRESSED_OUTPUT 1
+	#define COMPRESSED_UNIT uint8_t
+	#define ZLIB_AVAILABLE() compression::zlib::isAvailable()
+	#define ZLIB_DEFAULT_LEVEL compression::zlib::DefaultCompression
+#elif (LLVM_VERSION_MAJOR >= 7)
+	#define COMPRESSED_OUTPUT 1
+	#define COMPRESSED_UNIT char
+	#define ZLIB_AVAILABLE() zlib::isAvailable()
+	#define ZLIB_DEFAULT_LEVEL zlib::DefaultCompression
+#else
+	#define COMPRESSED_OUTPUT 0
+#endif
+
+#if (LLVM_VERSION_MAJOR >= 16)
+	#define ZSTD_AVAILABLE() compression::zstd::isAvailable()
+	#define ZSTD_DEFAULT_LEVEL compression::zstd::DefaultCompression
+#else
+	#define ZSTD_AVAILABLE() false
+	#define ZSTD_DEFAULT_LEVEL 0
+#endif
+
 static int kind_map[] = {
 	1, -1, 0,
 };
@@ -95,230 +194,5952 @@ static int kind_map[] = {
 #endif
 
 /**
-	// Identify the counts associated with the syntax areas.
+	// Output formats selected with the -F option.
 */
-int
-print_counters(FILE *fp, char *arch, char *object, char *datafile)
+enum Format {
+	format_text = 0,
+	format_binary,
+	format_indexed,
+};
+
+/**
+	// Include and exclude patterns. Patterns containing glob characters are
+	// matched with fnmatch; others are matched as prefixes.
+*/
+struct Filter {
+	std::vector<const char *> include;
+	std::vector<const char *> exclude;
+};
+
+/**
+	// Output compression methods; -z.
+*/
+enum Compression {
+	compression_none = 0,
+	compression_zlib,
+	compression_zstd,
+};
+
+/**
+	// Command line options shared by the queries.
+*/
+struct Options {
+	enum Format format;
+
+	/**
+		// Source path (-i, -x) and function name (-I, -X) filters.
+	*/
+	struct Filter paths;
+	struct Filter functions;
+
+	/**
+		// Whether branch coverage is included by -B.
+	*/
+	bool branches;
+
+	/**
+		// Number of workers used to compute file coverage; zero, when -j
+		// is not given, selects the number of hardware threads.
+	*/
+	unsigned jobs;
+
+	/**
+		// Compression method and level selected by -z.
+	*/
+	enum Compression compression;
+	int level;
+
+	/**
+		// Memory ceiling of the streaming mode in bytes; zero when disabled.
+	*/
+	size_t ceiling;
+
+	/**
+		// Whether the function names of regions are demangled by -D.
+	*/
+	bool demangle;
+
+	/**
+		// Whether uncovered prints all code regions, -A.
+	*/
+	bool all;
+} options = {
+	format_text,
+	{}, {},
+	false,
+	0,
+	compression_none,
+	-1,
+	0,
+	false,
+	false,
+};
+
+/**
+	// Phases measured by the -s option.
+*/
+enum Phase {
+	phase_profile = 0,
+	phase_load,
+	phase_records,
+	phase_coverage,
+	phase_output,
+	phase_count
+};
+
+/**
+	// Statistics reported by the -s option. Times are in nanoseconds and are summed
+	// across the threads performing a phase; the CPU times are per-thread.
+*/
+struct Statistics {
+	const char *path;
+	std::atomic<uint64_t> wall[phase_count];
+	std::atomic<uint64_t> cpu[phase_count];
+
+	/**
+		// Mapping records read from the images, including those shared by images.
+	*/
+	std::atomic<uint64_t> records;
+	std::atomic<uint64_t> files;
+	std::atomic<uint64_t> segments;
+	std::atomic<uint64_t> bytes;
+} stats;
+
+static void
+stats_clock(uint64_t *wall, uint64_t *cpu)
 {
-	auto mapping = CM_LOAD(object, datafile, arch);
+	struct timespec ts;
 
-	if (auto E = CRE_GET_ERROR(mapping))
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	*wall = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	*cpu = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+stats_add(enum Phase phase, uint64_t wall, uint64_t cpu)
+{
+	stats.wall[phase] += wall;
+	stats.cpu[phase] += cpu;
+}
+
+/**
+	// Measure the duration of a scope as part of a phase when statistics are enabled.
+*/
+class Measure
+{
+	enum Phase phase;
+	uint64_t wall, cpu;
+
+public:
+	Measure(enum Phase p) : phase(p), wall(0), cpu(0)
 	{
-		fprintf(stderr, "%s\n", ERR_STRING(E));
-		return(1);
+		resume();
 	}
 
-	auto coverage = std::move(mapping.get());
-	auto files = coverage.get()->getUniqueSourceFiles();
+	~Measure()
+	{
+		suspend();
+	}
 
-	for (auto &file : files)
+	/**
+		// Add the time since construction or the last resume to the phase.
+	*/
+	void
+	suspend()
 	{
-		auto data = coverage.get()->getCoverageForFile(file);
-		if (data.empty())
-			continue;
+		uint64_t w, c;
 
-		fprintf(fp, "@%.*s\n", (int) file.size(), file.data());
+		if (stats.path == NULL || wall == 0)
+			return;
 
-		for (auto seg : data)
-		{
-			if (seg.HasCount && seg.IsRegionEntry && seg.Count > 0)
-			{
-				fprintf(fp, "%u %u %llu\n", seg.Line, seg.Col, seg.Count);
-			}
-		}
+		stats_clock(&w, &c);
+		stats_add(phase, w - wall, c - cpu);
+		wall = 0;
 	}
 
-	return(0);
+	void
+	resume()
+	{
+		if (stats.path != NULL)
+			stats_clock(&wall, &cpu);
+	}
+};
+
+/**
+	// Stream cookie counting the bytes written to the wrapped file.
+*/
+static ssize_t
+stats_counted_write(void *cookie, const char *buf, size_t size)
+{
+	size_t r = fwrite(buf, 1, size, (FILE *) cookie);
+	stats.bytes += r;
+	return(r == size ? (ssize_t) r : -1);
 }
 
 /**
-	// Identify the regions of the sources that may have counts.
+	// Close the wrapped file unless it is one of the standard streams.
 */
-int
-print_regions(FILE *fp, char *arch, char *object)
+static int
+stats_counted_close(void *cookie)
 {
-	int last = -1;
-	auto CounterMappingBuff = MemoryBuffer::getFile(object);
+	FILE *fp = (FILE *) cookie;
+
+	if (fp == stdout || fp == stderr)
+		return(fflush(fp));
 
-	if (std::error_code EC = CounterMappingBuff.getError())
+	return(fclose(fp));
+}
+
+#if defined(__APPLE__) || defined(__FreeBSD__)
+	static int
+	stats_counted_funwrite(void *cookie, const char *buf, int size)
 	{
-		char *err = (char *) EC.message().c_str();
-		fprintf(stderr, "%s\n", err);
-		return(1);
+		return((int) stats_counted_write(cookie, buf, (size_t) size));
 	}
+#endif
 
-	POSTv9(SmallVector<std::unique_ptr<MemoryBuffer>, 4> bufs);
+/**
+	// Wrap &fp with a stream that counts the output bytes when statistics are enabled.
+	// Applied outside of &compressed_output so that the uncompressed size is counted.
+*/
+static FILE *
+stats_output(FILE *fp)
+{
+	FILE *counted;
 
-	auto CoverageReaderOrErr = CREATE_READER(CounterMappingBuff.get(), arch, bufs);
-	if (!CoverageReaderOrErr)
-	{
-		if (auto E = CRE_GET_ERROR(CoverageReaderOrErr))
-		{
-			fprintf(stderr, "%s\n", ERR_STRING(E));
-			return(1);
-		}
+	if (stats.path == NULL)
+		return(fp);
 
-		fprintf(stderr, "failed to load counter mapping reader from object\n");
-		return(1);
-	}
+	#if defined(__APPLE__) || defined(__FreeBSD__)
+		counted = funopen(fp, NULL, stats_counted_funwrite, NULL, stats_counted_close);
+	#else
+		cookie_io_functions_t io = {NULL, stats_counted_write, NULL, stats_counted_close};
+		counted = fopencookie(fp, "w", io);
+	#endif
 
-	ITER_CR_RECORDS(R, CoverageReaderOrErr.get())
-	{
-		if (auto E = CMR_GET_ERROR(R))
-			continue;
+	return(counted != NULL ? counted : fp);
+}
+
+/**
+	// Compressed output streams.
+
+	// Output is divided into chunks of &chunk_size bytes that are compressed
+	// independently. Each chunk is preceded by a sixteen byte header of
+	// little endian fields: the `ipqz` magic, the method (1 zlib, 2 zstd),
+	// the compressed size, and the original size. Chunks can be located by
+	// skipping headers and decompressed without the preceding data.
+*/
+static const size_t chunk_size = 1 << 22;
 
-		const auto &record = RECORD(R);
-		auto fname = record.FunctionName;
+struct Compressed {
+	FILE *fp;
+	std::string chunk;
+	#if (COMPRESSED_OUTPUT)
+		SmallVector<COMPRESSED_UNIT, 0> data;
+	#endif
+};
+
+/**
+	// Compress and write the pending chunk of &c.
+*/
+static int
+compressed_chunk(struct Compressed *c)
+{
+	#if (COMPRESSED_OUTPUT)
+		char header[16];
+
+		if (c->chunk.empty())
+			return(0);
 
-		fprintf(fp, "@%.*s\n", (int) fname.size(), fname.data());
+		c->data.clear();
 
-		for (auto region : record.MappingRegions)
+		#if (LLVM_VERSION_MAJOR >= 15)
 		{
-			const char *kind;
-			int ksz = 1;
-			auto fi = region.FileID;
-			auto fn = record.Filenames[fi];
+			ArrayRef<uint8_t> input((const uint8_t *) c->chunk.data(), c->chunk.size());
 
-			if (fi != last)
+			#if (LLVM_VERSION_MAJOR >= 16)
+				if (options.compression == compression_zstd)
+					compression::zstd::compress(input, c->data, options.level);
+				else
+			#endif
+					compression::zlib::compress(input, c->data, options.level);
+		}
+		#else
+			if (Error E = zlib::compress(StringRef(c->chunk), c->data, options.level))
 			{
-				fprintf(fp, "%lu:%.*s\n", fi, (int) fn.size(), fn.data());
-				last = fi;
+				fprintf(stderr, "compression: %s\n", toString(std::move(E)).c_str());
+				return(-1);
 			}
+		#endif
 
-			switch (region.Kind)
-			{
-				case coverage::CounterMappingRegion::CodeRegion:
-					ksz = 1;
-					kind = "+";
-				break;
-				case coverage::CounterMappingRegion::SkippedRegion:
-					ksz = 1;
-					kind = "-";
-				break;
-				case coverage::CounterMappingRegion::ExpansionRegion:
-					kind = "X";
-					kind = record.Filenames[region.ExpandedFileID].data();
-					ksz = record.Filenames[region.ExpandedFileID].size();
-				break;
-				case coverage::CounterMappingRegion::GapRegion:
-					ksz = 1;
-					kind = ".";
-				break;
-				default:
-					ksz = 1;
-					kind = "U";
-				break;
-			}
+		memcpy(header, "ipqz", 4);
+		support::endian::write32le(header + 4, (uint32_t) options.compression);
+		support::endian::write32le(header + 8, (uint32_t) c->data.size());
+		support::endian::write32le(header + 12, (uint32_t) c->chunk.size());
+		c->chunk.clear();
 
-			fprintf(fp, "%lu %lu %lu %lu %.*s\n",
-				(unsigned long) region.LineStart,
-				(unsigned long) region.ColumnStart,
-				(unsigned long) region.LineEnd,
-				(unsigned long) region.ColumnEnd, ksz, kind);
-		}
-	}
-	ITER_CR_CLOSE()
+		if (fwrite(header, 1, sizeof(header), c->fp) != sizeof(header))
+			return(-1);
+		if (fwrite(c->data.data(), 1, c->data.size(), c->fp) != c->data.size())
+			return(-1);
+	#endif
 
 	return(0);
 }
 
+static ssize_t
+compressed_write(void *cookie, const char *buf, size_t size)
+{
+	struct Compressed *c = (struct Compressed *) cookie;
+	size_t remainder = size;
+
+	while (remainder > 0)
+	{
+		size_t n = std::min(remainder, chunk_size - c->chunk.size());
+
+		c->chunk.append(buf, n);
+		buf += n;
+		remainder -= n;
+
+		if (c->chunk.size() == chunk_size && compressed_chunk(c) != 0)
+			return(-1);
+	}
+
+	return((ssize_t) size);
+}
+
 /**
-	// Identify the set of source files associated with an image.
+	// Write the final chunk and close the wrapped file unless it is a standard stream.
 */
-int
-print_sources(FILE *fp, char *arch, char *object)
+static int
+compressed_close(void *cookie)
 {
-	auto CounterMappingBuff = MemoryBuffer::getFile(object);
+	struct Compressed *c = (struct Compressed *) cookie;
+	FILE *fp = c->fp;
+	int r = compressed_chunk(c);
+
+	delete c;
+
+	if (fp == stdout || fp == stderr)
+		r |= fflush(fp);
+	else
+		r |= fclose(fp);
+
+	return(r != 0 ? -1 : 0);
+}
 
-	if (std::error_code EC = CounterMappingBuff.getError())
+#if defined(__APPLE__) || defined(__FreeBSD__)
+	static int
+	compressed_funwrite(void *cookie, const char *buf, int size)
 	{
-		char *err;
-		err = (char *) EC.message().c_str();
-		fprintf(stderr, "%s\n", err);
-		return(1);
+		return((int) compressed_write(cookie, buf, (size_t) size));
 	}
+#endif
+
+#ifndef IPQ_MODULE
+/**
+	// Parse &arg as a positive decimal integer; &what names the argument in the diagnostic.
+*/
+static int
+positive(const char *what, const char *arg, unsigned long *n)
+{
+	char *end;
 
-	POSTv9(SmallVector<std::unique_ptr<MemoryBuffer>, 4> bufs);
+	errno = 0;
+	*n = strtoul(arg, &end, 10);
 
-	auto CoverageReaderOrErr = CREATE_READER(CounterMappingBuff.get(), arch, bufs);
-	if (!CoverageReaderOrErr)
+	if (!isdigit((unsigned char) arg[0]) || *end != 0 || errno != 0 || *n == 0)
 	{
-		if (auto E = CRE_GET_ERROR(CoverageReaderOrErr))
-			fprintf(stderr, "%s\n", ERR_STRING(E));
-		else
-			fprintf(stderr, "unknown error\n");
-
-		return(1);
+		fprintf(stderr, "%s must be a positive integer: '%s'\n", what, arg);
+		return(-1);
 	}
 
-	std::set<std::string> paths;
+	return(0);
+}
 
-	/*
-		// The nested for loop will start a new section every time the fileid
-		// changes so the reader can properly associate ranges.
-	*/
+/**
+	// Select the compression method and level given to -z as `method[:level]`.
+	// Levels are checked against the method's range, 1 to 9 for zlib and 1 to
+	// 22 for zstd, as LLVM's compressors only assert on invalid levels.
+*/
+static int
+compression_select(const char *arg)
+{
+	const char *level = strchr(arg, ':');
+	StringRef method(arg, level != NULL ? (size_t) (level - arg) : strlen(arg));
+	unsigned long n, limit;
 
-	ITER_CR_RECORDS(R, CoverageReaderOrErr.get())
-	{
-		if (auto E = CMR_GET_ERROR(R))
-			continue;
+	#if (COMPRESSED_OUTPUT)
+		if (method == "zlib")
+		{
+			if (!ZLIB_AVAILABLE())
+			{
+				fprintf(stderr, "zlib compression is not available in this build of LLVM\n");
+				return(-1);
+			}
 
-		const auto &record = RECORD(R);
+			options.compression = compression_zlib;
+			options.level = ZLIB_DEFAULT_LEVEL;
+			limit = 9;
+		}
+		else if (method == "zstd")
+		{
+			if (!ZSTD_AVAILABLE())
+			{
+				fprintf(stderr, "zstd compression is not available in this build of LLVM\n");
+				return(-1);
+			}
 
-		for (const auto path : record.Filenames)
+			options.compression = compression_zstd;
+			options.level = ZSTD_DEFAULT_LEVEL;
+			limit = 22;
+		}
+		else
 		{
-			/*
-				// Usually one per function.
-			*/
-			paths.insert((std::string) path);
+			fprintf(stderr, "unknown compression method '%.*s'\n", (int) method.size(), method.data());
+			return(-1);
 		}
-	}
-	ITER_CR_CLOSE()
 
-	for (auto path : paths)
-	{
-		fprintf(fp, "%.*s\n", (int) path.length(), path.data());
-	}
+		if (level != NULL)
+		{
+			if (positive("the compression level", level + 1, &n) != 0)
+				return(-1);
 
-	return(0);
+			if (n > limit)
+			{
+				fprintf(stderr, "the %.*s compression level must be at most %lu: '%s'\n",
+					(int) method.size(), method.data(), limit, level + 1);
+				return(-1);
+			}
+
+			options.level = (int) n;
+		}
+
+		return(0);
+	#else
+		fprintf(stderr, "compressed output requires LLVM 7 or later\n");
+		return(-1);
+	#endif
 }
+#endif
 
-int
-main(int argc, char *argv[])
+/**
+	// Wrap &fp with a compressing stream when -z was given.
+*/
+static FILE *
+compressed_output(FILE *fp)
 {
-	if (argc < 2)
+	FILE *compressed;
+	struct Compressed *c;
+
+	if (options.compression == compression_none)
+		return(fp);
+
+	c = new Compressed;
+	c->fp = fp;
+	c->chunk.reserve(chunk_size);
+
+	#if defined(__APPLE__) || defined(__FreeBSD__)
+		compressed = funopen(c, NULL, compressed_funwrite, NULL, compressed_close);
+	#else
+		cookie_io_functions_t io = {NULL, compressed_write, NULL, compressed_close};
+		compressed = fopencookie(c, "w", io);
+	#endif
+
+	if (compressed == NULL)
 	{
-		fprintf(stderr, "ipq regions|sources|counters architecture image [merged-profile-data]\n");
-		fprintf(stderr, "Merged profile data is only required by counters.\n");
-		return(248);
+		delete c;
+		return(fp);
 	}
 
-	if (strcmp(argv[1], "regions") == 0)
+	return(compressed);
+}
+
+#ifndef IPQ_MODULE
+static const char *phase_names[phase_count] = {
+	"profile", "load", "records", "coverage", "output",
+};
+
+static double
+stats_seconds(uint64_t ns)
+{
+	return((double) ns / 1e9);
+}
+
+static double
+stats_timeval(struct timeval tv)
+{
+	return((double) tv.tv_sec + ((double) tv.tv_usec / 1e6));
+}
+
+/**
+	// Write the collected statistics as a JSON object to the -s path;
+	// `-` selects standard error.
+*/
+static void
+stats_write(const char *query, double elapsed)
+{
+	struct rusage ru;
+	FILE *fp;
+	uint64_t rss;
+
+	if (stats.path == NULL)
+		return;
+
+	if (strcmp(stats.path, "-") == 0)
+		fp = stderr;
+	else if ((fp = fopen(stats.path, "w")) == NULL)
 	{
-		if (argc != 4)
-			fprintf(stderr, "ERROR: regions requires exactly two arguments.\n", argv[1]);
-		else
-			return(print_regions(stdout, argv[2], argv[3]));
+		fprintf(stderr, "%s: %s\n", stats.path, strerror(errno));
+		return;
 	}
-	else if (strcmp(argv[1], "sources") == 0)
+
+	getrusage(RUSAGE_SELF, &ru);
+	#if defined(__APPLE__)
+		rss = (uint64_t) ru.ru_maxrss;
+	#else
+		rss = (uint64_t) ru.ru_maxrss * 1024;
+	#endif
+
+	fprintf(fp, "{\"query\": \"%s\", \"elapsed\": %.6f, \"user\": %.6f, \"system\": %.6f, \"phases\": {",
+		query, elapsed, stats_timeval(ru.ru_utime), stats_timeval(ru.ru_stime));
+
+	for (int i = 0; i < phase_count; ++i)
 	{
-		if (argc != 4)
-			fprintf(stderr, "ERROR: sources requires exactly two arguments.\n", argv[1]);
-		else
-			return(print_sources(stdout, argv[2], argv[3]));
+		fprintf(fp, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}",
+			i == 0 ? "" : ", ", phase_names[i],
+			stats_seconds(stats.wall[i]), stats_seconds(stats.cpu[i]));
 	}
-	else
+
+	fprintf(fp, "}, \"records\": %llu, \"files\": %llu, \"segments\": %llu, "
+		"\"output_bytes\": %llu, \"peak_rss\": %llu}\n",
+		(unsigned long long) stats.records,
+		(unsigned long long) stats.files,
+		(unsigned long long) stats.segments,
+		(unsigned long long) stats.bytes,
+		(unsigned long long) rss);
+
+	if (fp != stderr)
+		fclose(fp);
+}
+#endif
+
+static bool
+filter_match(const char *pattern, StringRef subject)
+{
+	if (strpbrk(pattern, "*?[") != NULL)
+		return(fnmatch(pattern, ((std::string) subject).c_str(), 0) == 0);
+
+	return(subject.startswith(pattern));
+}
+
+/**
+	// Whether &subject is included and not excluded by &f.
+*/
+static bool
+filter_select(const struct Filter *f, StringRef subject)
+{
+	if (!f->include.empty())
 	{
-		if (strcmp(argv[1], "counters") == 0)
+		bool included = false;
+
+		for (auto pattern : f->include)
 		{
-			if (argc != 5)
-				fprintf(stderr, "ERROR: counters requires exactly three arguments.\n", argv[1]);
-			else
-				return(print_counters(stdout, argv[2], argv[3], argv[4]));
+			if (filter_match(pattern, subject))
+			{
+				included = true;
+				break;
+			}
 		}
-		else
-			fprintf(stderr, "unknown query '%s'\n", argv[1]);
+
+		if (!included)
+			return(false);
 	}
 
-	return(1);
+	for (auto pattern : f->exclude)
+	{
+		if (filter_match(pattern, subject))
+			return(false);
+	}
+
+	return(true);
 }
+
+static bool
+filter_empty(const struct Filter *f)
+{
+	return(f->include.empty() && f->exclude.empty());
+}
+
+/**
+	// Whether the source &path is selected by the path filters.
+	// Decisions are cached as the same paths are referenced by most records;
+	// only called from the main thread.
+*/
+static bool
+select_path(StringRef path)
+{
+	static StringMap<bool> decisions;
+
+	if (filter_empty(&options.paths))
+		return(true);
+
+	auto r = decisions.insert(std::make_pair(path, false));
+	if (r.second)
+		r.first->second = filter_select(&options.paths, path);
+
+	return(r.first->second);
+}
+
+static bool
+select_function(StringRef name)
+{
+	return(filter_select(&options.functions, name));
+}
+
+/**
+	// Identify the selected files of a record's filename table.
+*/
+template <typename Filenames>
+static SmallBitVector
+select_record_files(const Filenames &filenames)
+{
+	SmallBitVector selected(filenames.size());
+
+	for (size_t i = 0; i < filenames.size(); ++i)
+		selected[i] = select_path(filenames[i]);
+
+	return(selected);
+}
+
+/**
+	// Identify the profiles designated by &datafile; either the file itself
+	// or the regular files contained by the directory.
+*/
+static int
+profile_paths(char *datafile, std::vector<std::string> &paths)
+{
+	std::error_code EC;
+
+	if (!sys::fs::is_directory(datafile))
+	{
+		paths.push_back(datafile);
+		return(0);
+	}
+
+	for (sys::fs::directory_iterator i(datafile, EC), end; i != end && !EC; i.increment(EC))
+	{
+		if (sys::fs::is_regular_file(i->path()))
+			paths.push_back(i->path());
+	}
+
+	if (EC)
+	{
+		fprintf(stderr, "%s: %s\n", datafile, EC.message().c_str());
+		return(1);
+	}
+
+	/* Merge order does not change the result, but keep the shards stable. */
+	std::sort(paths.begin(), paths.end());
+	return(0);
+}
+
+#if (RAW_PROFILES)
+/**
+	// Merge the raw profile at &path into &writer.
+*/
+static Error
+merge_raw_profile(InstrProfWriter &writer, const std::string &path)
+{
+	auto ReaderOrErr = InstrProfReader::create(path);
+	if (Error E = ReaderOrErr.takeError())
+		return(E);
+
+	auto reader = std::move(ReaderOrErr.get());
+
+	if (Error E = MERGE_PROFILE_KIND(writer, reader))
+		return(E);
+
+	for (auto &record : *reader)
+	{
+		writer.addRecord(std::move(record), 1, [&](Error E) {
+			fprintf(stderr, "%s: %s\n", path.c_str(), toString(std::move(E)).c_str());
+		});
+	}
+
+	if (reader->hasError())
+		return(reader->getError());
+
+	return(Error::success());
+}
+
+/**
+	// Merge the raw profiles designated by &datafile in memory.
+
+	// The profiles are divided into shards merged by separate writers on a
+	// pool of workers and the shards are then merged into the first writer.
+	// The indexed profile is produced in memory and never written to disk.
+	// The shards and the final merge are measured apart so that the profile
+	// phase has the CPU time of every worker and the wall time is never
+	// counted twice; the caller's measure is suspended.
+*/
+static std::unique_ptr<MemoryBuffer>
+merge_raw_profiles(char *datafile)
+{
+	std::vector<std::string> paths;
+	unsigned jobs = options.jobs ? options.jobs : std::thread::hardware_concurrency();
+
+	if (profile_paths(datafile, paths) != 0)
+		return(nullptr);
+
+	if (paths.empty())
+	{
+		fprintf(stderr, "%s: no raw profiles found\n", datafile);
+		return(nullptr);
+	}
+
+	jobs = std::max(1u, std::min(jobs, (unsigned) paths.size()));
+
+	std::vector<std::unique_ptr<InstrProfWriter>> writers;
+	std::vector<std::string> errors(jobs);
+	std::vector<std::thread> workers;
+
+	for (unsigned j = 0; j < jobs; ++j)
+		writers.emplace_back(new InstrProfWriter());
+
+	auto shard = [&](unsigned j) {
+		Measure m(phase_profile);
+
+		for (size_t i = j; i < paths.size(); i += jobs)
+		{
+			if (Error E = merge_raw_profile(*writers[j], paths[i]))
+			{
+				errors[j] = paths[i] + ": " + toString(std::move(E));
+				return;
+			}
+		}
+	};
+
+	if (jobs == 1)
+		shard(0);
+	else
+	{
+		for (unsigned j = 0; j < jobs; ++j)
+			workers.emplace_back(shard, j);
+		for (auto &w : workers)
+			w.join();
+	}
+
+	for (auto &err : errors)
+	{
+		if (!err.empty())
+		{
+			fprintf(stderr, "%s\n", err.c_str());
+			return(nullptr);
+		}
+	}
+
+	Measure m(phase_profile);
+	for (unsigned j = 1; j < jobs; ++j)
+	{
+		writers[0]->mergeRecordsFromWriter(std::move(*writers[j]), [&](Error E) {
+			fprintf(stderr, "%s\n", toString(std::move(E)).c_str());
+		});
+	}
+
+	return(writers[0]->writeBuffer());
+}
+#endif
+
+/**
+	// Whether &datafile refers to an indexed profile.
+*/
+static bool
+indexed_profile(char *datafile)
+{
+	if (sys::fs::is_directory(datafile))
+		return(false);
+
+	auto buf = MemoryBuffer::getFile(datafile);
+	if (!buf)
+		/* Let the reader report the error. */
+		return(true);
+
+	return(IndexedInstrProfReader::hasFormat(*buf.get()));
+}
+
+#if (LLVM_VERSION_MAJOR >= 9)
+/**
+	// Open the profile, &datafile. Raw profiles, or directories of them, are merged
+	// in memory when supported.
+*/
+static std::unique_ptr<IndexedInstrProfReader>
+load_profile(char *datafile)
+{
+	Measure m(phase_profile);
+
+	if (!indexed_profile(datafile))
+	{
+		#if (RAW_PROFILES)
+			m.suspend();
+			auto merged = merge_raw_profiles(datafile);
+			m.resume();
+			if (!merged)
+				return(nullptr);
+
+			auto ProfileReaderOrErr = IndexedInstrProfReader::create(std::move(merged));
+		#else
+			fprintf(stderr, "%s: raw profiles require LLVM 11 or later\n", datafile);
+			return(nullptr);
+		#endif
+
+		if (auto E = CRE_GET_ERROR(ProfileReaderOrErr))
+		{
+			fprintf(stderr, "%s: %s\n", datafile, ERR_STRING(E));
+			return(nullptr);
+		}
+
+		return(std::move(ProfileReaderOrErr.get()));
+	}
+
+	auto ProfileReaderOrErr = IndexedInstrProfReader::create(datafile);
+
+	if (auto E = CRE_GET_ERROR(ProfileReaderOrErr))
+	{
+		fprintf(stderr, "%s: %s\n", datafile, ERR_STRING(E));
+		return(nullptr);
+	}
+
+	return(std::move(ProfileReaderOrErr.get()));
+}
+
+/**
+	// Coverage mapping reader counting the records read for -s. The readers of
+	// &open_readers are wrapped so that the records loaded by CoverageMapping::load
+	// are counted like those of &read_records.
+*/
+class CountedReader : public coverage::CoverageMappingReader
+{
+	std::unique_ptr<coverage::CoverageMappingReader> reader;
+
+public:
+	CountedReader(std::unique_ptr<coverage::CoverageMappingReader> r) : reader(std::move(r))
+	{
+	}
+
+	Error
+	readNextRecord(coverage::CoverageMappingRecord &record) override
+	{
+		Error E = reader->readNextRecord(record);
+
+		if (!E)
+			++stats.records;
+
+		return(E);
+	}
+};
+
+/**
+	// The coverage readers of a set of images and the buffers they refer to.
+*/
+struct Readers {
+	std::vector<std::unique_ptr<MemoryBuffer>> images;
+	SmallVector<std::unique_ptr<MemoryBuffer>, 4> objects;
+	std::vector<std::unique_ptr<coverage::CoverageMappingReader>> readers;
+};
+
+static int
+open_readers(struct Readers *rs, char *arch, int nimages, char **images)
+{
+	for (int i = 0; i < nimages; ++i)
+	{
+		auto CounterMappingBuff = MemoryBuffer::getFile(images[i]);
+
+		if (std::error_code EC = CounterMappingBuff.getError())
+		{
+			fprintf(stderr, "%s: %s\n", images[i], EC.message().c_str());
+			return(1);
+		}
+
+		rs->images.push_back(std::move(CounterMappingBuff.get()));
+
+		auto CoverageReaderOrErr = CREATE_READER(rs->images.back(), arch, rs->objects);
+		if (!CoverageReaderOrErr)
+		{
+			if (auto E = CRE_GET_ERROR(CoverageReaderOrErr))
+				fprintf(stderr, "%s\n", ERR_STRING(E));
+			else
+				fprintf(stderr, "failed to load counter mapping reader from object\n");
+
+			return(1);
+		}
+
+		for (auto &reader : CoverageReaderOrErr.get())
+			rs->readers.emplace_back(new CountedReader(std::move(reader)));
+	}
+
+	return(0);
+}
+#endif
+
+/**
+	// Buffered writer used by the text formats.
+
+	// Integers are formatted directly into the buffer, and the buffer is written
+	// with a single fwrite when it fills or is flushed. Without a file, the output
+	// is accumulated so that workers can format in parallel and &take the result.
+*/
+class Writer
+{
+	FILE *fp;
+	std::string buf;
+
+	static const size_t limit = 1 << 20;
+
+	void
+	check()
+	{
+		if (fp != NULL && buf.size() >= limit)
+			flush();
+	}
+
+public:
+	Writer(FILE *f = NULL) : fp(NULL)
+	{
+		attach(f);
+	}
+
+	~Writer()
+	{
+		flush();
+	}
+
+	void
+	attach(FILE *f)
+	{
+		flush();
+		fp = f;
+
+		if (fp != NULL)
+			buf.reserve(limit + 256);
+	}
+
+	int
+	flush()
+	{
+		size_t size = buf.size();
+
+		if (fp == NULL || size == 0)
+			return(0);
+
+		size_t r = fwrite(buf.data(), 1, size, fp);
+		buf.clear();
+
+		return(r == size ? 0 : -1);
+	}
+
+	std::string
+	take()
+	{
+		std::string r;
+		r.swap(buf);
+		return(r);
+	}
+
+	Writer &
+	put(char c)
+	{
+		buf.push_back(c);
+		check();
+		return(*this);
+	}
+
+	Writer &
+	put(StringRef str)
+	{
+		buf.append(str.data(), str.size());
+		check();
+		return(*this);
+	}
+
+	Writer &
+	put(const char *str, size_t size)
+	{
+		buf.append(str, size);
+		check();
+		return(*this);
+	}
+
+	/**
+		// Append the decimal representation of &n.
+	*/
+	Writer &
+	number(uint64_t n)
+	{
+		static const char digits[] =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+		char tmp[20];
+		char *p = tmp + sizeof(tmp);
+
+		while (n >= 100)
+		{
+			unsigned i = (n % 100) * 2;
+			n /= 100;
+			*--p = digits[i + 1];
+			*--p = digits[i];
+		}
+
+		if (n >= 10)
+		{
+			unsigned i = n * 2;
+			*--p = digits[i + 1];
+			*--p = digits[i];
+		}
+		else
+			*--p = '0' + n;
+
+		return(put(p, tmp + sizeof(tmp) - p));
+	}
+};
+
+#if (LLVM_VERSION_MAJOR < 9)
+/**
+	// Count the function records of a loaded mapping when statistics are enabled;
+	// the records read by CoverageMapping::load cannot be observed before LLVM 9.
+*/
+static void
+count_functions(const coverage::CoverageMapping &cov)
+{
+	if (stats.path == NULL)
+		return;
+
+	for (const auto &function : cov.getCoveredFunctions())
+	{
+		(void) function;
+		++stats.records;
+	}
+}
+#endif
+
+/**
+	// Load the coverage mapping of &images against the profile, &datafile.
+	// Errors are reported to standard error and &nullptr is returned.
+
+	// The profile is opened here rather than by CoverageMapping::load so that
+	// reading it is measured as the profile phase and raw profiles can be merged.
+*/
+static std::unique_ptr<coverage::CoverageMapping>
+load_mapping(char *arch, int nimages, char **images, char *datafile)
+{
+	if (!CM_MULTIPLE_IMAGES && nimages > 1)
+	{
+		fprintf(stderr, "multiple images are not supported by this version of LLVM\n");
+		return(nullptr);
+	}
+
+	#if (LLVM_VERSION_MAJOR >= 9)
+		struct Readers rs;
+
+		auto profile = load_profile(datafile);
+		if (!profile)
+			return(nullptr);
+
+		Measure m(phase_load);
+		if (open_readers(&rs, arch, nimages, images) != 0)
+			return(nullptr);
+
+		auto mapping = coverage::CoverageMapping::load(rs.readers, *profile);
+	#else
+		std::vector<StringRef> objects(images, images + nimages);
+		std::vector<StringRef> arches(nimages, StringRef(arch));
+
+		Measure m(phase_load);
+		auto mapping = CM_LOAD(objects, datafile, arches);
+	#endif
+
+	if (auto E = CRE_GET_ERROR(mapping))
+	{
+		fprintf(stderr, "%s\n", ERR_STRING(E));
+		return(nullptr);
+	}
+
+	#if (LLVM_VERSION_MAJOR < 9)
+		count_functions(*mapping.get());
+	#endif
+
+	return(std::move(mapping.get()));
+}
+
+/**
+	// Compute the coverage of &file; measured as the coverage phase.
+*/
+static coverage::CoverageData
+file_coverage(const coverage::CoverageMapping &cov, StringRef file)
+{
+	Measure m(phase_coverage);
+	auto data = cov.getCoverageForFile(file);
+
+	++stats.files;
+	stats.segments += std::distance(data.begin(), data.end());
+	return(data);
+}
+
+/**
+	// Print the branch coverage of a file selected by -B.
+
+	// Branches are printed as `b line column end-line end-column true false folded`.
+	// &data is the file's coverage or the coverage of its selected functions.
+*/
+template <typename Coverage>
+static void
+print_file_branches(Writer &w, const Coverage &data)
+{
+	#if (BRANCH_REGIONS)
+		for (const auto &branch : data.getBranches())
+		{
+			w.put("b ", 2).number(branch.LineStart).put(' ').number(branch.ColumnStart).put(' ');
+			w.number(branch.LineEnd).put(' ').number(branch.ColumnEnd).put(' ');
+			w.number(branch.ExecutionCount).put(' ').number(branch.FalseExecutionCount).put(' ');
+			w.put(branch.Folded ? '1' : '0').put('\n');
+		}
+	#endif
+}
+
+/**
+	// Print the counted region entries of a single source file.
+*/
+template <typename Segments>
+static void
+print_file_counters(Writer &w, StringRef file, const Segments &data)
+{
+	w.put('@').put(file).put('\n');
+
+	for (const auto &seg : data)
+	{
+		if (seg.HasCount && seg.IsRegionEntry && seg.Count > 0)
+		{
+			w.number(seg.Line).put(' ').number(seg.Col).put(' ').number(seg.Count).put('\n');
+		}
+	}
+
+	if (options.branches)
+		print_file_branches(w, data);
+}
+
+/**
+	// Columnar output format written by -F binary.
+
+	// The file starts with &ColumnsHeader followed by the string table offsets,
+	// the string data, the section table, and the row columns at the offsets
+	// recorded in the header. All offsets are relative to the start of the file
+	// and aligned to eight bytes so that the columns can be used in place from
+	// a memory map. Integers are stored in native byte order; readers can
+	// check &ColumnsHeader.order to identify it.
+
+	// String &i is located at `string_data + string_offsets[i]` and is
+	// NUL-terminated; `string_offsets` has `strings + 1` entries so that the
+	// length is the difference of adjacent offsets minus one.
+
+	// Sections identify a contiguous range of rows belonging to a file and,
+	// for regions, a function. The kind column holds LLVM's RegionKind.
+	// Expansion regions store the string index of the expanded file in the
+	// count column as regions have no counts.
+*/
+struct ColumnsHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t order;
+
+	uint64_t strings;
+	uint64_t string_offsets;
+	uint64_t string_data;
+
+	uint64_t sections;
+	uint64_t section_table;
+
+	uint64_t rows;
+	uint64_t count;
+	uint64_t line;
+	uint64_t column;
+	uint64_t end_line;
+	uint64_t end_column;
+	uint64_t kind;
+};
+
+struct ColumnsSection {
+	uint32_t file;
+	uint32_t function; /* UINT32_MAX when the section is not a function's. */
+	uint64_t start;
+	uint64_t rows;
+};
+
+/**
+	// Accumulated columns; written by &columns_write once all rows are known.
+*/
+struct Columns {
+	StringMap<uint32_t> index;
+	std::vector<uint64_t> string_offsets;
+	std::string string_data;
+
+	std::vector<struct ColumnsSection> sections;
+
+	std::vector<uint64_t> count;
+	std::vector<uint32_t> line, column, end_line, end_column;
+	std::vector<uint8_t> kind;
+};
+
+/**
+	// Intern &str into the string table.
+*/
+static uint32_t
+columns_string(struct Columns *c, StringRef str)
+{
+	auto r = c->index.insert(std::make_pair(str, (uint32_t) c->string_offsets.size()));
+
+	if (r.second)
+	{
+		c->string_offsets.push_back(c->string_data.size());
+		c->string_data.append(str.data(), str.size());
+		c->string_data.push_back('\0');
+	}
+
+	return(r.first->second);
+}
+
+/**
+	// Start a new section for the rows that follow.
+*/
+static void
+columns_section(struct Columns *c, uint32_t file, uint32_t function)
+{
+	struct ColumnsSection s = {file, function, (uint64_t) c->count.size(), 0};
+	c->sections.push_back(s);
+}
+
+static void
+columns_row(struct Columns *c,
+	uint32_t line, uint32_t column, uint32_t end_line, uint32_t end_column,
+	uint8_t kind, uint64_t count)
+{
+	c->line.push_back(line);
+	c->column.push_back(column);
+	c->end_line.push_back(end_line);
+	c->end_column.push_back(end_column);
+	c->kind.push_back(kind);
+	c->count.push_back(count);
+	c->sections.back().rows += 1;
+}
+
+/**
+	// Write a column's data and pad it to the next eight byte boundary.
+*/
+static uint64_t
+columns_put(FILE *fp, uint64_t offset, const void *data, size_t size)
+{
+	static const char padding[8] = {0};
+	size_t pad = (8 - (size % 8)) % 8;
+
+	fwrite(data, 1, size, fp);
+	fwrite(padding, 1, pad, fp);
+
+	return(offset + size + pad);
+}
+
+static uint64_t
+columns_aligned(uint64_t size)
+{
+	return((size + 7) & ~((uint64_t) 7));
+}
+
+static int
+columns_write(FILE *fp, struct Columns *c)
+{
+	struct ColumnsHeader h;
+	uint64_t n = c->count.size();
+	uint64_t offset;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "ipqcols", 8);
+	h.version = 1;
+	h.order = 0x01020304;
+
+	c->string_offsets.push_back(c->string_data.size());
+	h.strings = c->string_offsets.size() - 1;
+	h.sections = c->sections.size();
+	h.rows = n;
+
+	h.string_offsets = columns_aligned(sizeof(h));
+	h.string_data = h.string_offsets + columns_aligned(c->string_offsets.size() * sizeof(uint64_t));
+	h.section_table = h.string_data + columns_aligned(c->string_data.size());
+	h.count = h.section_table + columns_aligned(c->sections.size() * sizeof(struct ColumnsSection));
+	h.line = h.count + columns_aligned(n * sizeof(uint64_t));
+	h.column = h.line + columns_aligned(n * sizeof(uint32_t));
+	h.end_line = h.column + columns_aligned(n * sizeof(uint32_t));
+	h.end_column = h.end_line + columns_aligned(n * sizeof(uint32_t));
+	h.kind = h.end_column + columns_aligned(n * sizeof(uint32_t));
+
+	offset = columns_put(fp, 0, &h, sizeof(h));
+	offset = columns_put(fp, offset, c->string_offsets.data(), c->string_offsets.size() * sizeof(uint64_t));
+	offset = columns_put(fp, offset, c->string_data.data(), c->string_data.size());
+	offset = columns_put(fp, offset, c->sections.data(), c->sections.size() * sizeof(struct ColumnsSection));
+	offset = columns_put(fp, offset, c->count.data(), n * sizeof(uint64_t));
+	offset = columns_put(fp, offset, c->line.data(), n * sizeof(uint32_t));
+	offset = columns_put(fp, offset, c->column.data(), n * sizeof(uint32_t));
+	offset = columns_put(fp, offset, c->end_line.data(), n * sizeof(uint32_t));
+	offset = columns_put(fp, offset, c->end_column.data(), n * sizeof(uint32_t));
+	offset = columns_put(fp, offset, c->kind.data(), n * sizeof(uint8_t));
+
+	c->string_offsets.pop_back();
+
+	if (fflush(fp) != 0 || ferror(fp))
+	{
+		fprintf(stderr, "failed to write columns: %s\n", strerror(errno));
+		return(1);
+	}
+
+	return(0);
+}
+
+/**
+	// Record the counted region entries of a single source file as a section.
+*/
+template <typename Segments>
+static void
+columns_file_counters(struct Columns *c, StringRef file, const Segments &data)
+{
+	columns_section(c, columns_string(c, file), UINT32_MAX);
+
+	for (const auto &seg : data)
+	{
+		if (seg.HasCount && seg.IsRegionEntry && seg.Count > 0)
+		{
+			columns_row(c, seg.Line, seg.Col, 0, 0,
+				coverage::CounterMappingRegion::CodeRegion, seg.Count);
+		}
+	}
+}
+
+/**
+	// Record the regions of a function; a section is started for every
+	// change in file identifier. Regions of unselected files are skipped.
+*/
+template <typename Filenames, typename Regions>
+static void
+columns_function_regions(struct Columns *c, StringRef fname, const Filenames &filenames, const Regions &regions,
+	const SmallBitVector &selected)
+{
+	uint32_t function = columns_string(c, fname);
+	int last = -1;
+
+	for (const auto &region : regions)
+	{
+		uint64_t count = 0;
+
+		if (!selected[region.FileID])
+			continue;
+
+		if ((int) region.FileID != last)
+		{
+			last = region.FileID;
+			columns_section(c, columns_string(c, filenames[region.FileID]), function);
+		}
+
+		if (region.Kind == coverage::CounterMappingRegion::ExpansionRegion)
+			count = columns_string(c, filenames[region.ExpandedFileID]);
+
+		columns_row(c,
+			region.LineStart, region.ColumnStart,
+			region.LineEnd, region.ColumnEnd,
+			region.Kind, count);
+	}
+}
+
+/**
+	// Compute the coverage of &files using a pool of workers.
+
+	// &prepare is called by the workers to compute each file's result and
+	// the result is given to &emit on the calling thread in the order of &files.
+	// The workers are limited to a window of files ahead of the emitted one so
+	// that the finished results do not accumulate without bound.
+*/
+template <typename T, typename Prepare, typename Emit>
+static void
+parallel_files(const coverage::CoverageMapping &, const std::vector<StringRef> &files, Prepare prepare, Emit emit)
+{
+	size_t nfiles = files.size();
+	unsigned jobs = options.jobs ? options.jobs : std::thread::hardware_concurrency();
+
+	if (jobs <= 1 || nfiles <= 1)
+	{
+		for (auto &file : files)
+		{
+			T result = prepare(file);
+			emit(file, result);
+		}
+
+		return;
+	}
+
+	size_t window = jobs * 4;
+	size_t next = 0, written = 0;
+	std::vector<T> slots(nfiles);
+	std::vector<char> done(nfiles, 0);
+	std::mutex lock;
+	std::condition_variable ready, space;
+	std::vector<std::thread> workers;
+
+	auto work = [&]() {
+		while (1)
+		{
+			size_t i;
+			{
+				std::unique_lock<std::mutex> l(lock);
+				space.wait(l, [&]() { return(next >= nfiles || next < written + window); });
+
+				if (next >= nfiles)
+					return;
+				i = next++;
+			}
+
+			T result = prepare(files[i]);
+
+			{
+				std::lock_guard<std::mutex> l(lock);
+				slots[i] = std::move(result);
+				done[i] = 1;
+			}
+			ready.notify_one();
+		}
+	};
+
+	for (unsigned j = 0; j < jobs; ++j)
+		workers.emplace_back(work);
+
+	for (size_t i = 0; i < nfiles; ++i)
+	{
+		T result;
+		{
+			std::unique_lock<std::mutex> l(lock);
+			ready.wait(l, [&]() { return(done[i] != 0); });
+			result = std::move(slots[i]);
+		}
+
+		emit(files[i], result);
+
+		{
+			std::lock_guard<std::mutex> l(lock);
+			written = i + 1;
+		}
+		space.notify_all();
+	}
+
+	for (auto &w : workers)
+		w.join();
+}
+
+/**
+	// Format the counters of a file into a buffer.
+*/
+template <typename Segments>
+static std::string
+format_file_counters(StringRef file, const Segments &data)
+{
+	Writer w;
+
+	if (data.empty())
+		return(std::string());
+
+	print_file_counters(w, file, data);
+	return(w.take());
+}
+
+/**
+	// The source files of &cov selected by the path filters.
+*/
+static std::vector<StringRef>
+selected_files(const coverage::CoverageMapping &cov)
+{
+	auto files = cov.getUniqueSourceFiles();
+
+	if (!filter_empty(&options.paths))
+	{
+		files.erase(std::remove_if(files.begin(), files.end(),
+			[](StringRef file) { return(!select_path(file)); }), files.end());
+	}
+
+	return(files);
+}
+
+/**
+	// Build the segments of a file from its counted regions as getCoverageForFile does.
+
+	// LLVM's segment builder is internal to CoverageMapping.cpp, so it is reproduced
+	// here for the coverage that is assembled from a subset of the functions. The
+	// regions are sorted with enclosing regions first, identical regions are combined,
+	// and a segment is started wherever the innermost active region changes.
+*/
+class SegmentBuilder
+{
+	typedef std::pair<unsigned, unsigned> Location;
+
+	std::vector<coverage::CoverageSegment> &segments;
+	std::vector<const coverage::CountedRegion *> active;
+
+	void
+	start(const coverage::CountedRegion &region, Location at, bool entry, bool skipped = false)
+	{
+		bool counted = !skipped && region.Kind != coverage::CounterMappingRegion::SkippedRegion;
+
+		/* Segments that would not change the rendering are omitted. */
+		if (!segments.empty() && !entry && !skipped)
+		{
+			const auto &last = segments.back();
+
+			if (last.HasCount == counted && last.Count == region.ExecutionCount && !last.IsRegionEntry)
+				return;
+		}
+
+		if (counted)
+			segments.emplace_back(at.first, at.second, region.ExecutionCount, entry,
+				region.Kind == coverage::CounterMappingRegion::GapRegion);
+		else
+			segments.emplace_back(at.first, at.second, entry);
+	}
+
+	/**
+		// Start the segments of the active regions from &first that end before &at,
+		// or of all of them when &at is NULL.
+	*/
+	void
+	complete(const Location *at, size_t first)
+	{
+		std::stable_sort(active.begin() + first, active.end(),
+			[](const coverage::CountedRegion *a, const coverage::CountedRegion *b) {
+				return(a->endLoc() < b->endLoc());
+			});
+
+		for (size_t i = first + 1; i < active.size(); ++i)
+		{
+			const auto *completed = active[i];
+			Location end = active[i - 1]->endLoc();
+
+			if (at != NULL && end == *at)
+				break;
+			if (end == completed->endLoc())
+				continue;
+
+			/* The count is that of the last region ending at the same location. */
+			for (size_t j = i + 1; j < active.size(); ++j)
+			{
+				if (completed->endLoc() == active[j]->endLoc())
+					completed = active[j];
+			}
+
+			start(*completed, end, false);
+		}
+
+		const auto *last = active.back();
+
+		if (first > 0 && last->endLoc() != *at)
+			start(*active[first - 1], last->endLoc(), false);
+		else if (first == 0 && (at == NULL || *at != last->endLoc()))
+			start(*last, last->endLoc(), false, true);
+
+		active.erase(active.begin() + first, active.end());
+	}
+
+	void
+	build(ArrayRef<coverage::CountedRegion> regions)
+	{
+		for (size_t i = 0; i < regions.size(); ++i)
+		{
+			const auto &region = regions[i];
+			Location at = region.startLoc();
+			bool gap = region.Kind == coverage::CounterMappingRegion::GapRegion;
+
+			auto completed = std::stable_partition(active.begin(), active.end(),
+				[&](const coverage::CountedRegion *r) { return(!(r->endLoc() <= at)); });
+			if (completed != active.end())
+				complete(&at, completed - active.begin());
+
+			if (at == region.endLoc())
+			{
+				/* Zero length regions are never made active. */
+				bool skipped = i + 1 == regions.size()
+					|| region.Kind == coverage::CounterMappingRegion::SkippedRegion;
+
+				start(active.empty() ? region : *active.back(), at, !gap, skipped);
+				if (skipped && !active.empty())
+					start(*active.back(), at, false);
+				continue;
+			}
+
+			/* Of the regions starting at a location, only the innermost is entered. */
+			if (i + 1 == regions.size() || at != regions[i + 1].startLoc())
+				start(region, at, !gap);
+
+			active.push_back(&region);
+		}
+
+		if (!active.empty())
+			complete(NULL, 0);
+	}
+
+	SegmentBuilder(std::vector<coverage::CoverageSegment> &s) : segments(s)
+	{
+	}
+
+public:
+	/**
+		// Build the segments of &regions; the regions are reordered and combined in place.
+	*/
+	static std::vector<coverage::CoverageSegment>
+	segments_of(std::vector<coverage::CountedRegion> &regions)
+	{
+		std::vector<coverage::CoverageSegment> segments;
+		size_t n = 0;
+
+		if (regions.empty())
+			return(segments);
+
+		/* Identical regions are ordered by kind so that code regions come first. */
+		std::sort(regions.begin(), regions.end(),
+			[](const coverage::CountedRegion &a, const coverage::CountedRegion &b) {
+				if (a.startLoc() != b.startLoc())
+					return(a.startLoc() < b.startLoc());
+				if (a.endLoc() != b.endLoc())
+					return(b.endLoc() < a.endLoc());
+				return(a.Kind < b.Kind);
+			});
+
+		/*
+			// Only the counts of the first region's kind are summed so that code
+			// regions of a fully expanded macro are not counted twice.
+		*/
+		for (size_t i = 1; i < regions.size(); ++i)
+		{
+			auto &r = regions[n];
+
+			if (r.startLoc() != regions[i].startLoc() || r.endLoc() != regions[i].endLoc())
+				regions[++n] = regions[i];
+			else if (regions[i].Kind == r.Kind)
+				r.ExecutionCount += regions[i].ExecutionCount;
+		}
+		regions.erase(regions.begin() + n + 1, regions.end());
+
+		SegmentBuilder(segments).build(regions);
+		return(segments);
+	}
+};
+
+/**
+	// Whether regions of &kind are given to &SegmentBuilder by getCoverageForFile;
+	// branch and decision regions are reported apart from the segments.
+*/
+static bool
+segment_kind(unsigned kind)
+{
+	switch (kind)
+	{
+		case coverage::CounterMappingRegion::CodeRegion:
+		case coverage::CounterMappingRegion::ExpansionRegion:
+		case coverage::CounterMappingRegion::SkippedRegion:
+		case coverage::CounterMappingRegion::GapRegion:
+			return(true);
+		default:
+			return(false);
+	}
+}
+
+/**
+	// The functions selected by the function filters grouped by the files that
+	// they have regions in; built with a single pass over the functions.
+*/
+typedef StringMap<std::vector<const coverage::FunctionRecord *>> FileFunctions;
+
+static FileFunctions
+selected_functions(const coverage::CoverageMapping &cov)
+{
+	FileFunctions files;
+
+	for (const auto &function : cov.getCoveredFunctions())
+	{
+		if (!select_function(function.Name))
+			continue;
+
+		for (size_t i = 0; i < function.Filenames.size(); ++i)
+		{
+			const auto &fn = function.Filenames[i];
+
+			/* Expansions can refer to the same file more than once. */
+			if (std::find(function.Filenames.begin(), function.Filenames.begin() + i, fn)
+				== function.Filenames.begin() + i)
+				files[fn].push_back(&function);
+		}
+	}
+
+	return(files);
+}
+
+/**
+	// Coverage of a file limited to the selected functions; iterates as the
+	// file's segments and provides the branches as CoverageData does.
+*/
+struct FunctionCoverage {
+	std::vector<coverage::CoverageSegment> segments;
+
+	#if (BRANCH_REGIONS)
+		std::vector<coverage::CountedRegion> branches;
+
+		ArrayRef<coverage::CountedRegion>
+		getBranches() const
+		{
+			return(branches);
+		}
+	#endif
+
+	std::vector<coverage::CoverageSegment>::const_iterator
+	begin() const
+	{
+		return(segments.begin());
+	}
+
+	std::vector<coverage::CoverageSegment>::const_iterator
+	end() const
+	{
+		return(segments.end());
+	}
+
+	bool
+	empty() const
+	{
+		return(segments.empty());
+	}
+};
+
+/**
+	// The coverage of &file limited to the regions of the selected functions.
+	// Regions of instantiations are combined like the segments of getCoverageForFile,
+	// and the branches outside of expansions are collected as it does.
+*/
+static struct FunctionCoverage
+function_coverage(const FileFunctions &functions, StringRef file)
+{
+	struct FunctionCoverage fc;
+	std::vector<coverage::CountedRegion> regions;
+	Measure m(phase_coverage);
+
+	auto i = functions.find(file);
+	if (i == functions.end())
+		return(fc);
+
+	++stats.files;
+
+	for (const auto *function : i->second)
+	{
+		for (const auto &region : function->CountedRegions)
+		{
+			if (function->Filenames[region.FileID] == file)
+				regions.push_back(region);
+		}
+
+		if (!options.branches)
+			continue;
+
+		#if (BRANCH_REGIONS)
+			for (const auto &branch : function->CountedBranchRegions)
+			{
+				if (function->Filenames[branch.FileID] == file && branch.FileID == branch.ExpandedFileID)
+					fc.branches.push_back(branch);
+			}
+		#endif
+	}
+
+	fc.segments = SegmentBuilder::segments_of(regions);
+	stats.segments += fc.segments.size();
+	return(fc);
+}
+
+/**
+	// Record the counters of the selected source files covered by &cov into &columns.
+*/
+static void
+columns_counters(struct Columns *columns, const coverage::CoverageMapping &cov)
+{
+	auto files = selected_files(cov);
+
+	if (!filter_empty(&options.functions))
+	{
+		auto functions = selected_functions(cov);
+
+		parallel_files<struct FunctionCoverage>(cov, files,
+			[&](StringRef file) {
+				return(function_coverage(functions, file));
+			},
+			[&](StringRef file, struct FunctionCoverage &data) {
+				Measure m(phase_output);
+				if (!data.empty())
+					columns_file_counters(columns, file, data);
+			}
+		);
+	}
+	else
+	{
+		parallel_files<coverage::CoverageData>(cov, files,
+			[&](StringRef file) {
+				return(file_coverage(cov, file));
+			},
+			[&](StringRef file, coverage::CoverageData &data) {
+				Measure m(phase_output);
+				if (!data.empty())
+					columns_file_counters(columns, file, data);
+			}
+		);
+	}
+}
+
+/**
+	// Write the counters of the source files covered by &cov.
+
+	// Unselected files are removed before any coverage is computed, and when
+	// function filters are present, the segments are built from the regions of
+	// the selected functions instead of the file's coverage.
+*/
+static int
+write_counters(FILE *fp, const coverage::CoverageMapping &cov)
+{
+	auto files = selected_files(cov);
+	bool filtered = !filter_empty(&options.functions);
+	FileFunctions functions;
+
+	if (options.format == format_binary)
+	{
+		struct Columns columns;
+
+		columns_counters(&columns, cov);
+
+		Measure m(phase_output);
+		return(columns_write(fp, &columns));
+	}
+
+	if (filtered)
+		functions = selected_functions(cov);
+
+	parallel_files<std::string>(cov, files,
+		[&](StringRef file) {
+			if (filtered)
+			{
+				auto data = function_coverage(functions, file);
+				Measure m(phase_output);
+				return(format_file_counters(file, data));
+			}
+			else
+			{
+				auto data = file_coverage(cov, file);
+				Measure m(phase_output);
+				return(format_file_counters(file, data));
+			}
+		},
+		[&](StringRef, std::string &text) {
+			Measure m(phase_output);
+			fwrite(text.data(), 1, text.size(), fp);
+		}
+	);
+
+	return(0);
+}
+
+/**
+	// Identify the counts associated with the syntax areas.
+
+	// All &images are loaded against the single profile, &datafile, so the
+	// profile is only indexed once and the sources shared by the images
+	// are reported once.
+*/
+int
+print_counters(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	auto coverage = load_mapping(arch, nimages, images, datafile);
+	if (!coverage)
+		return(1);
+
+	return(write_counters(fp, *coverage));
+}
+
+#if (LLVM_VERSION_MAJOR >= 7)
+/**
+	// Line flags of the lines query.
+*/
+enum LineFlags {
+	line_mapped = 1,
+	line_region_entry = 2,
+	line_executed = 4,
+};
+
+struct LineHits {
+	uint64_t count;
+	uint8_t flags;
+};
+
+/**
+	// Identify the execution count and flags of every line of a file starting at line one
+	// using LLVM's line coverage iteration.
+*/
+static std::vector<struct LineHits>
+file_lines(const coverage::CoverageData &data)
+{
+	std::vector<struct LineHits> lines;
+
+	if (data.empty())
+		return(lines);
+
+	coverage::LineCoverageIterator i(data, 1);
+	auto end = i.getEnd();
+
+	for (; i != end; ++i)
+	{
+		const auto &stats = *i;
+		struct LineHits h = {0, 0};
+
+		if (stats.isMapped())
+		{
+			h.count = stats.getExecutionCount();
+			h.flags |= line_mapped;
+		}
+
+		for (const auto *seg : stats.getLineSegments())
+		{
+			if (seg->IsRegionEntry)
+			{
+				h.flags |= line_region_entry;
+				break;
+			}
+		}
+
+		lines.push_back(h);
+	}
+
+	return(lines);
+}
+
+static std::string
+format_file_lines(StringRef file, const std::vector<struct LineHits> &lines)
+{
+	Writer w;
+
+	if (lines.empty())
+		return(std::string());
+
+	w.put('@').put(file).put('\n');
+	for (const auto &h : lines)
+		w.number(h.count).put(' ').number(h.flags).put('\n');
+
+	return(w.take());
+}
+
+static void
+columns_file_lines(struct Columns *c, StringRef file, const std::vector<struct LineHits> &lines)
+{
+	columns_section(c, columns_string(c, file), UINT32_MAX);
+
+	for (size_t i = 0; i < lines.size(); ++i)
+		columns_row(c, i + 1, 0, 0, 0, lines[i].flags, lines[i].count);
+}
+
+/**
+	// Identify the execution count of every line of the covered sources.
+
+	// Files are printed as `@path` followed by one `count flags` line for every
+	// source line starting at line one so that consumers can index lines directly.
+	// Flags is the sum of 1, the line is mapped, and 2, a region starts on the line.
+	// Unmapped lines have a zero count. In the binary format, the kind column holds
+	// the flags. Function filters are not applied as the lines are computed from
+	// the file's coverage.
+*/
+int
+print_lines(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	typedef std::vector<struct LineHits> Lines;
+
+	auto coverage = load_mapping(arch, nimages, images, datafile);
+	if (!coverage)
+		return(1);
+
+	const coverage::CoverageMapping &cov = *coverage;
+	auto files = selected_files(cov);
+
+	if (options.format == format_binary)
+	{
+		struct Columns columns;
+
+		parallel_files<Lines>(cov, files,
+			[&](StringRef file) {
+				return(file_lines(file_coverage(cov, file)));
+			},
+			[&](StringRef file, Lines &lines) {
+				Measure m(phase_output);
+				if (!lines.empty())
+					columns_file_lines(&columns, file, lines);
+			}
+		);
+
+		Measure m(phase_output);
+		return(columns_write(fp, &columns));
+	}
+
+	parallel_files<std::string>(cov, files,
+		[&](StringRef file) {
+			auto lines = file_lines(file_coverage(cov, file));
+			Measure m(phase_output);
+			return(format_file_lines(file, lines));
+		},
+		[&](StringRef, std::string &text) {
+			Measure m(phase_output);
+			fwrite(text.data(), 1, text.size(), fp);
+		}
+	);
+
+	return(0);
+}
+
+/**
+	// A changed line range of a source file.
+*/
+struct Change {
+	std::string path;
+	unsigned start, end;
+};
+
+/**
+	// Read the changed ranges from &fp.
+
+	// The input is either a unified diff, in which case the ranges are the runs of
+	// added lines of the new files, or lines of the form `path:start[-end]`. Any
+	// `diff `, `--- `, or `+++ ` header makes the input a diff, and the lines outside
+	// of its headers and hunks, such as those of a commit's description, are ignored.
+	// Hunks are read by their line counts so that their lines are never taken as
+	// headers. The `b/` prefix of the diff's paths is removed.
+*/
+static int
+read_changes(FILE *fp, std::vector<struct Change> &changes)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t n;
+	std::vector<std::string> lines;
+	std::string path;
+	unsigned next = 0, run = 0;
+	unsigned long old_lines = 0, new_lines = 0;
+	bool diff = false;
+
+	while ((n = getline(&line, &size, fp)) != -1)
+	{
+		StringRef l(line, n);
+		l = l.rtrim("\r\n");
+
+		if (l.startswith("diff ") || l.startswith("--- ") || l.startswith("+++ "))
+			diff = true;
+		lines.push_back(l.str());
+	}
+	free(line);
+
+	auto close_run = [&]() {
+		if (run > 0)
+			changes.push_back({path, run, next - 1});
+		run = 0;
+	};
+
+	for (StringRef l : lines)
+	{
+		if (old_lines > 0 || new_lines > 0)
+		{
+			/* Hunk lines; a line inconsistent with the counts ends the hunk. */
+			if (l.startswith("+") && new_lines > 0)
+			{
+				if (run == 0)
+					run = next;
+				++next;
+				--new_lines;
+				continue;
+			}
+			else if ((l.startswith(" ") || l.empty()) && old_lines > 0 && new_lines > 0)
+			{
+				close_run();
+				++next;
+				--old_lines;
+				--new_lines;
+				continue;
+			}
+			else if (l.startswith("-") && old_lines > 0)
+			{
+				close_run();
+				--old_lines;
+				continue;
+			}
+			else if (l.startswith("\\"))
+				continue;
+
+			close_run();
+			old_lines = new_lines = 0;
+		}
+
+		if (!diff)
+		{
+			/* path:start[-end] */
+			size_t colon = l.rfind(':');
+			unsigned long start, end;
+
+			if (colon == StringRef::npos)
+				continue;
+
+			auto bounds = l.substr(colon + 1).split('-');
+			if (bounds.first.getAsInteger(10, start))
+			{
+				fprintf(stderr, "invalid change '%.*s'\n", (int) l.size(), l.data());
+				return(1);
+			}
+
+			if (bounds.second.empty() || bounds.second.getAsInteger(10, end))
+				end = start;
+
+			changes.push_back({l.substr(0, colon).str(), (unsigned) start, (unsigned) end});
+		}
+		else if (l.startswith("+++ "))
+		{
+			close_run();
+			path = l.substr(4).split('\t').first.str();
+			if (StringRef(path).startswith("b/"))
+				path = path.substr(2);
+		}
+		else if (l.startswith("@@ -"))
+		{
+			/* @@ -start[,count] +start[,count] @@; an omitted count is one. */
+			StringRef h = l.substr(4);
+			unsigned long start;
+
+			close_run();
+			old_lines = new_lines = 1;
+
+			if (h.consumeInteger(10, start) || (h.consume_front(",") && h.consumeInteger(10, old_lines))
+				|| !h.consume_front(" +") || h.consumeInteger(10, start)
+				|| (h.consume_front(",") && h.consumeInteger(10, new_lines)))
+			{
+				fprintf(stderr, "invalid hunk header '%.*s'\n", (int) l.size(), l.data());
+				return(1);
+			}
+
+			next = start;
+		}
+	}
+
+	close_run();
+
+	/* Deleted files */
+	changes.erase(std::remove_if(changes.begin(), changes.end(),
+		[](const struct Change &c) { return(c.path == "/dev/null" || c.end < c.start); }), changes.end());
+
+	return(0);
+}
+
+/**
+	// Identify the source file of the mapping named by a change's &path; either the
+	// same path or a source file that ends with the path as a relative one.
+*/
+static StringRef
+change_file(const std::vector<StringRef> &files, StringRef path)
+{
+	for (auto file : files)
+	{
+		if (file == path)
+			return(file);
+
+		if (file.endswith(path) && file.size() > path.size()
+			&& sys::path::is_separator(file[file.size() - path.size() - 1]))
+			return(file);
+	}
+
+	return(StringRef());
+}
+
+/**
+	// Mark the mapped and executed lines of &data within the change &c in &states,
+	// which holds a state for each line of the range that can be mapped.
+
+	// LineCoverageIterator only consumes the segments of the lines it visits, so
+	// it starts at the first segment and the lines before the range are skipped.
+*/
+static void
+change_states(const coverage::CoverageData &data, const struct Change &c, std::vector<uint8_t> &states)
+{
+	coverage::LineCoverageIterator li(data);
+	auto end = li.getEnd();
+
+	for (; li != end; ++li)
+	{
+		unsigned line = li->getLine();
+
+		if (line < c.start)
+			continue;
+		if (line - c.start >= states.size())
+			break;
+		if (!li->isMapped())
+			continue;
+
+		states[line - c.start] |= line_mapped;
+		if (li->getExecutionCount() > 0)
+			states[line - c.start] |= line_executed;
+	}
+}
+
+/**
+	// Report the coverage of changed line ranges read from &changes; `-` for standard input.
+
+	// Only the functions of the changed files whose regions overlap a range
+	// have their coverage computed. Each range is printed as
+	// `status start end executed-lines mapped-lines path` where status is
+	// `covered` when every mapped line was executed, `uncovered` when none
+	// were, `partial` otherwise, and `unmapped` when the range has no mapped lines.
+*/
+int
+print_changed(FILE *fp, char *changes_path, char *arch, int nimages, char **images, char *datafile)
+{
+	std::vector<struct Change> changes;
+	FILE *cfp = strcmp(changes_path, "-") == 0 ? stdin : fopen(changes_path, "r");
+
+	if (cfp == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", changes_path, strerror(errno));
+		return(1);
+	}
+
+	int r = read_changes(cfp, changes);
+	if (cfp != stdin)
+		fclose(cfp);
+	if (r != 0)
+		return(r);
+
+	auto coverage = load_mapping(arch, nimages, images, datafile);
+	if (!coverage)
+		return(1);
+
+	const coverage::CoverageMapping &cov = *coverage;
+	auto files = selected_files(cov);
+	std::map<StringRef, std::vector<size_t>> byfile;
+	std::vector<std::vector<uint8_t>> states(changes.size());
+	Writer w(fp);
+
+	for (size_t i = 0; i < changes.size(); ++i)
+	{
+		StringRef file = change_file(files, changes[i].path);
+
+		if (!file.empty())
+			byfile[file].push_back(i);
+	}
+
+	for (const auto &entry : byfile)
+	{
+		StringRef file = entry.first;
+		unsigned last = 0;
+		Measure m(phase_coverage);
+
+		/* The states of a range are limited to the file's last mapped line. */
+		for (const auto &function : cov.getCoveredFunctions(file))
+		{
+			for (const auto &region : function.CountedRegions)
+			{
+				if (function.Filenames[region.FileID] == file)
+					last = std::max(last, region.LineEnd);
+			}
+		}
+
+		for (auto ci : entry.second)
+		{
+			if (changes[ci].start <= last)
+				states[ci].resize(std::min(changes[ci].end, last) - changes[ci].start + 1, 0);
+		}
+
+		++stats.files;
+		for (const auto &function : cov.getCoveredFunctions(file))
+		{
+			std::vector<size_t> overlapping;
+
+			for (auto ci : entry.second)
+			{
+				if (states[ci].empty())
+					continue;
+
+				for (const auto &region : function.CountedRegions)
+				{
+					if (function.Filenames[region.FileID] == file
+						&& region.LineStart <= changes[ci].end && region.LineEnd >= changes[ci].start)
+					{
+						overlapping.push_back(ci);
+						break;
+					}
+				}
+			}
+
+			if (overlapping.empty())
+				continue;
+
+			auto data = cov.getCoverageForFunction(function);
+			if (data.getFilename() != file)
+				continue;
+
+			stats.segments += std::distance(data.begin(), data.end());
+
+			for (auto ci : overlapping)
+				change_states(data, changes[ci], states[ci]);
+		}
+	}
+
+	Measure m(phase_output);
+	for (size_t i = 0; i < changes.size(); ++i)
+	{
+		const auto &c = changes[i];
+		unsigned long mapped = 0, executed = 0;
+		const char *status;
+
+		for (auto s : states[i])
+		{
+			mapped += (s & line_mapped) != 0;
+			executed += (s & line_executed) != 0;
+		}
+
+		if (mapped == 0)
+			status = "unmapped";
+		else if (executed == mapped)
+			status = "covered";
+		else if (executed == 0)
+			status = "uncovered";
+		else
+			status = "partial";
+
+		w.put(status).put(' ').number(c.start).put(' ').number(c.end).put(' ');
+		w.number(executed).put(' ').number(mapped).put(' ').put(c.path).put('\n');
+	}
+
+	return(w.flush() != 0);
+}
+
+/**
+	// Covered and total counts of a summary of the export query.
+*/
+struct Tally {
+	uint64_t count;
+	uint64_t covered;
+
+	void
+	add(const struct Tally &t)
+	{
+		count += t.count;
+		covered += t.covered;
+	}
+
+	void
+	merge(const struct Tally &t)
+	{
+		count = std::max(count, t.count);
+		covered = std::max(covered, t.covered);
+	}
+};
+
+/**
+	// The summary of a file, or the totals, as computed by llvm-cov report.
+*/
+struct Summary {
+	struct Tally lines;
+	struct Tally functions;
+	struct Tally instantiations;
+	struct Tally regions;
+	struct Tally branches;
+};
+
+/**
+	// A file's JSON object and its summary; produced by the workers of &print_export.
+*/
+struct ExportFile {
+	std::string json;
+	struct Summary summary;
+};
+
+/**
+	// Write &s as a JSON string.
+*/
+static void
+json_string(Writer &w, StringRef s)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t start = 0;
+
+	w.put('"');
+	for (size_t i = 0; i < s.size(); ++i)
+	{
+		unsigned char c = s[i];
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		w.put(s.data() + start, i - start);
+		start = i + 1;
+
+		switch (c)
+		{
+			case '"': w.put("\\\""); break;
+			case '\\': w.put("\\\\"); break;
+			case '\b': w.put("\\b"); break;
+			case '\f': w.put("\\f"); break;
+			case '\n': w.put("\\n"); break;
+			case '\r': w.put("\\r"); break;
+			case '\t': w.put("\\t"); break;
+			default:
+				w.put("\\u00").put(hex[c >> 4]).put(hex[c & 0xF]);
+			break;
+		}
+	}
+	w.put(s.data() + start, s.size() - start).put('"');
+}
+
+/**
+	// Write the `"key":{...}` member of &t. Percentages are formatted as LLVM's JSON writer does.
+*/
+static void
+json_tally(Writer &w, const char *key, const struct Tally &t, bool notcovered)
+{
+	char percent[32];
+	double p = t.count == 0 ? 0.0 : (double) t.covered / (double) t.count * 100.0;
+	int psz = snprintf(percent, sizeof(percent), "%.*g", std::numeric_limits<double>::max_digits10, p);
+
+	w.put('"').put(key).put("\":{\"count\":").number(t.count);
+	w.put(",\"covered\":").number(t.covered);
+	if (notcovered)
+		w.put(",\"notcovered\":").number(t.count - t.covered);
+	w.put(",\"percent\":").put(percent, psz).put('}');
+}
+
+/**
+	// Write the `"summary"` object of &s with the members in the sorted order of llvm-cov.
+*/
+static void
+json_summary(Writer &w, const char *key, const struct Summary &s)
+{
+	w.put('"').put(key).put("\":{");
+	json_tally(w, "branches", s.branches, true);
+	w.put(',');
+	json_tally(w, "functions", s.functions, false);
+	w.put(',');
+	json_tally(w, "instantiations", s.instantiations, false);
+	w.put(',');
+	json_tally(w, "lines", s.lines, false);
+	w.put(',');
+	json_tally(w, "regions", s.regions, true);
+	w.put('}');
+}
+
+#if (BRANCH_REGIONS)
+/**
+	// Count the unfolded branches of &data and the expansions it contains; both
+	// outcomes of a branch are counted.
+*/
+static void
+export_branches(const coverage::CoverageMapping &cov, const coverage::CoverageData &data, struct Tally *t)
+{
+	for (const auto &b : data.getBranches())
+	{
+		if (b.Folded)
+			continue;
+
+		t->count += 2;
+		t->covered += (b.ExecutionCount > 0) + (b.FalseExecutionCount > 0);
+	}
+
+	for (const auto &e : data.getExpansions())
+		export_branches(cov, cov.getCoverageForExpansion(e), t);
+}
+#endif
+
+/**
+	// Summarize an instantiation of a function.
+*/
+static struct Summary
+export_function(const coverage::CoverageMapping &cov, const coverage::FunctionRecord &f)
+{
+	struct Summary s;
+
+	memset(&s, 0, sizeof(s));
+	for (const auto &r : f.CountedRegions)
+	{
+		if (r.Kind != coverage::CounterMappingRegion::CodeRegion)
+			continue;
+
+		s.regions.count += 1;
+		s.regions.covered += r.ExecutionCount != 0;
+	}
+
+	auto data = cov.getCoverageForFunction(f);
+	if (data.empty())
+		return(s);
+
+	coverage::LineCoverageIterator i(data);
+	for (auto end = i.getEnd(); i != end; ++i)
+	{
+		if (!i->isMapped())
+			continue;
+
+		s.lines.count += 1;
+		s.lines.covered += i->getExecutionCount() != 0;
+	}
+
+	#if (BRANCH_REGIONS)
+		export_branches(cov, data, &s.branches);
+	#endif
+
+	return(s);
+}
+
+/**
+	// Format the JSON object of &file and compute its summary.
+
+	// Functions are summarized by instantiation group: the group's lines, regions,
+	// and branches are the greatest of its instantiations', and it is executed when
+	// any of its instantiations are.
+*/
+static struct ExportFile
+export_file(const coverage::CoverageMapping &cov, StringRef file)
+{
+	struct ExportFile ef;
+	Writer w;
+	auto data = file_coverage(cov, file);
+
+	memset(&ef.summary, 0, sizeof(ef.summary));
+
+	{
+		Measure m(phase_coverage);
+
+		for (const auto &group : cov.getInstantiationGroups(file))
+		{
+			struct Summary gs;
+			bool first = true;
+
+			for (const auto *f : group.getInstantiations())
+			{
+				if (!select_function(f->Name))
+					continue;
+
+				struct Summary fs = export_function(cov, *f);
+
+				ef.summary.instantiations.count += 1;
+				ef.summary.instantiations.covered += f->ExecutionCount > 0;
+
+				if (first)
+					gs = fs;
+				else
+				{
+					gs.lines.merge(fs.lines);
+					gs.regions.merge(fs.regions);
+					gs.branches.merge(fs.branches);
+				}
+				first = false;
+			}
+
+			if (first)
+				continue;
+
+			ef.summary.lines.add(gs.lines);
+			ef.summary.regions.add(gs.regions);
+			ef.summary.branches.add(gs.branches);
+			ef.summary.functions.count += 1;
+			ef.summary.functions.covered += group.getTotalExecutionCount() > 0;
+		}
+	}
+
+	Measure m(phase_output);
+	bool first = true;
+
+	w.put("{\"filename\":");
+	json_string(w, file);
+	w.put(",\"segments\":[");
+	for (const auto &seg : data)
+	{
+		uint64_t count = std::min(seg.Count, (uint64_t) INT64_MAX);
+
+		if (!first)
+			w.put(',');
+		first = false;
+
+		w.put('[').number(seg.Line).put(',').number(seg.Col).put(',').number(count);
+		w.put(seg.HasCount ? ",true" : ",false");
+		w.put(seg.IsRegionEntry ? ",true" : ",false");
+		w.put(seg.IsGapRegion ? ",true]" : ",false]");
+	}
+	w.put("],");
+	json_summary(w, "summary", ef.summary);
+	w.put('}');
+
+	ef.json = w.take();
+	return(ef);
+}
+
+/**
+	// Write the files, segments, and summaries of the selected sources in the
+	// format of `llvm-cov export`.
+
+	// The branch, expansion, and function arrays of llvm-cov's output are omitted.
+	// Files are summarized by the workers selected by -j and the objects are written
+	// in the order of the files as they finish. Function filters apply to the summaries.
+*/
+int
+print_export(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	struct Summary totals;
+	bool first = true;
+	Writer w(fp);
+
+	auto coverage = load_mapping(arch, nimages, images, datafile);
+	if (!coverage)
+		return(1);
+
+	const coverage::CoverageMapping &cov = *coverage;
+	auto files = selected_files(cov);
+
+	memset(&totals, 0, sizeof(totals));
+	w.put("{\"data\":[{\"files\":[");
+
+	parallel_files<struct ExportFile>(cov, files,
+		[&](StringRef file) {
+			return(export_file(cov, file));
+		},
+		[&](StringRef, struct ExportFile &ef) {
+			Measure m(phase_output);
+
+			if (!first)
+				w.put(',');
+			first = false;
+			w.put(ef.json);
+
+			totals.lines.add(ef.summary.lines);
+			totals.functions.add(ef.summary.functions);
+			totals.instantiations.add(ef.summary.instantiations);
+			totals.regions.add(ef.summary.regions);
+			totals.branches.add(ef.summary.branches);
+		}
+	);
+
+	w.put("],");
+	json_summary(w, "totals", totals);
+	w.put("}],\"type\":\"llvm.coverage.json.export\",\"version\":\"2.0.1\"}\n");
+
+	return(w.flush() != 0);
+}
+#else
+int
+print_lines(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	fprintf(stderr, "lines requires LLVM 7 or later\n");
+	return(1);
+}
+
+int
+print_changed(FILE *fp, char *changes_path, char *arch, int nimages, char **images, char *datafile)
+{
+	fprintf(stderr, "changed requires LLVM 7 or later\n");
+	return(1);
+}
+
+int
+print_export(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	fprintf(stderr, "export requires LLVM 7 or later\n");
+	return(1);
+}
+#endif
+
+/**
+	// Select the kind identifier of a region's &kind; &expansion is the
+	// filename referenced by the region's ExpandedFileID.
+*/
+static const char *
+region_kind(unsigned kind, StringRef expansion, int *ksz)
+{
+	*ksz = 1;
+
+	switch (kind)
+	{
+		case coverage::CounterMappingRegion::CodeRegion:
+			return("+");
+		case coverage::CounterMappingRegion::SkippedRegion:
+			return("-");
+		case coverage::CounterMappingRegion::ExpansionRegion:
+			*ksz = expansion.size();
+			return(expansion.data());
+		case coverage::CounterMappingRegion::GapRegion:
+			return(".");
+		#if (BRANCH_REGIONS)
+			case coverage::CounterMappingRegion::BranchRegion:
+				return(options.branches ? "B" : "U");
+		#endif
+		default:
+			return("U");
+	}
+}
+
+/**
+	// Print the regions of a function record. &last is the previously
+	// printed file identifier and is updated when a new one is printed.
+	// Regions of unselected files are skipped.
+*/
+template <typename Filenames, typename Regions>
+static void
+print_function_regions(Writer &w, StringRef fname, const Filenames &filenames, const Regions &regions, int *last,
+	const SmallBitVector &selected)
+{
+	w.put('@').put(fname).put('\n');
+
+	for (const auto &region : regions)
+	{
+		const char *kind;
+		int ksz = 1;
+		auto fi = region.FileID;
+		StringRef fn = filenames[fi];
+
+		if (!selected[fi])
+			continue;
+
+		if ((int) fi != *last)
+		{
+			w.number(fi).put(':').put(fn).put('\n');
+			*last = fi;
+		}
+
+		kind = region_kind(region.Kind, filenames[region.ExpandedFileID], &ksz);
+
+		w.number(region.LineStart).put(' ').number(region.ColumnStart).put(' ');
+		w.number(region.LineEnd).put(' ').number(region.ColumnEnd).put(' ');
+		w.put(kind, ksz).put('\n');
+	}
+}
+
+/**
+	// State of a regions query spanning the records of multiple images.
+
+	// Function records are identified by their name and hash so that
+	// the records shared by multiple images are only printed once.
+*/
+struct Regions {
+	std::set<std::pair<std::string, uint64_t>> functions;
+	struct Columns columns;
+
+	/**
+		// Text output; attached to the query's file.
+	*/
+	Writer out;
+
+	/**
+		// Identifiers of the filenames declared by -F indexed.
+	*/
+	StringMap<uint32_t> files;
+};
+
+/**
+	// Identify the filename, declaring it with a `=id:path` line on first use.
+*/
+static uint32_t
+regions_file(struct Regions *rs, StringRef path)
+{
+	auto r = rs->files.insert(std::make_pair(path, (uint32_t) rs->files.size()));
+
+	if (r.second)
+		rs->out.put('=').number(r.first->second).put(':').put(path).put('\n');
+
+	return(r.first->second);
+}
+
+/**
+	// Print the regions of a function record with filenames referenced by
+	// their identifier in the global table: `file line column end-line end-column kind`.
+	// Expansion regions use `X` followed by the identifier of the expanded file.
+*/
+template <typename Filenames, typename MappingRegions>
+static void
+print_function_regions_indexed(struct Regions *rs, StringRef fname,
+	const Filenames &filenames, const MappingRegions &regions, const SmallBitVector &selected)
+{
+	Writer &w = rs->out;
+	SmallVector<int64_t, 8> ids(filenames.size(), -1);
+
+	/* Declarations precede the function so that its lines are contiguous. */
+	for (const auto &region : regions)
+	{
+		if (!selected[region.FileID])
+			continue;
+
+		if (ids[region.FileID] < 0)
+			ids[region.FileID] = regions_file(rs, filenames[region.FileID]);
+
+		if (region.Kind == coverage::CounterMappingRegion::ExpansionRegion && ids[region.ExpandedFileID] < 0)
+			ids[region.ExpandedFileID] = regions_file(rs, filenames[region.ExpandedFileID]);
+	}
+
+	w.put('@').put(fname).put('\n');
+
+	for (const auto &region : regions)
+	{
+		int ksz = 1;
+		const char *kind;
+
+		if (!selected[region.FileID])
+			continue;
+
+		w.number(ids[region.FileID]).put(' ');
+		w.number(region.LineStart).put(' ').number(region.ColumnStart).put(' ');
+		w.number(region.LineEnd).put(' ').number(region.ColumnEnd).put(' ');
+
+		if (region.Kind == coverage::CounterMappingRegion::ExpansionRegion)
+			w.put('X').number(ids[region.ExpandedFileID]).put('\n');
+		else
+		{
+			kind = region_kind(region.Kind, StringRef(), &ksz);
+			w.put(kind, ksz).put('\n');
+		}
+	}
+}
+
+/**
+	// The position of the `:` or `;` ending the file prefix of a local function's
+	// name; the prefix must be a source file name or the rest a mangled symbol so
+	// that the colons of Objective-C selectors, `-[Foo bar:baz:]`, are not taken.
+*/
+static size_t
+function_prefix(StringRef name)
+{
+	for (size_t split = name.find_first_of(":;"); split != StringRef::npos; split = name.find_first_of(":;", split + 1))
+	{
+		StringRef prefix = name.substr(0, split), symbol = name.substr(split + 1);
+
+		if (symbol.startswith("_Z") || symbol.startswith("__Z"))
+			return(split);
+		if (prefix.find_first_of("[ ") == StringRef::npos && sys::path::has_extension(prefix))
+			return(split);
+	}
+
+	return(StringRef::npos);
+}
+
+/**
+	// The displayed form of a function name. With -D, the symbol is demangled and
+	// the `file:` (or `file;`) prefix of local functions is moved after a tab.
+	// Results are cached per unique name for the life of the process.
+*/
+static StringRef
+function_name(StringRef name)
+{
+	#if (LLVM_VERSION_MAJOR >= 9)
+		static StringMap<std::string> names;
+
+		if (!options.demangle)
+			return(name);
+
+		auto r = names.insert(std::make_pair(name, std::string()));
+		if (r.second)
+		{
+			size_t split = function_prefix(name);
+			StringRef symbol = split == StringRef::npos ? name : name.substr(split + 1);
+			std::string &display = r.first->second;
+
+			display = demangle(symbol.str());
+			if (split != StringRef::npos)
+			{
+				display.push_back('\t');
+				display.append(name.data(), split);
+			}
+		}
+
+		return(r.first->second);
+	#else
+		return(name);
+	#endif
+}
+
+/**
+	// Print or record the regions of a mapping record. &last is the file identifier
+	// most recently printed for the image that the record was read from.
+*/
+static void
+regions_record(struct Regions *rs, const coverage::CoverageMappingRecord &record, int *last)
+{
+	auto fname = record.FunctionName;
+
+	if (!select_function(fname))
+		return;
+
+	auto selected = select_record_files(record.Filenames);
+	if (selected.none())
+		return;
+
+	if (!rs->functions.emplace((std::string) fname, record.FunctionHash).second)
+		return;
+
+	fname = function_name(fname);
+	if (options.format == format_binary)
+		columns_function_regions(&rs->columns, fname, record.Filenames, record.MappingRegions, selected);
+	else if (options.format == format_indexed)
+		print_function_regions_indexed(rs, fname, record.Filenames, record.MappingRegions, selected);
+	else
+		print_function_regions(rs->out, fname, record.Filenames, record.MappingRegions, last, selected);
+}
+
+static int
+regions_finish(FILE *fp, struct Regions *rs)
+{
+	Measure m(phase_output);
+
+	if (options.format == format_binary)
+		return(columns_write(fp, &rs->columns));
+
+	return(rs->out.flush() != 0);
+}
+
+/**
+	// Add the selected paths referenced by a mapping record to &paths.
+	// Paths are only copied when they are first seen.
+*/
+static void
+sources_record(StringSet<> &paths, const coverage::CoverageMappingRecord &record)
+{
+	if (!select_function(record.FunctionName))
+		return;
+
+	for (const auto path : record.Filenames)
+	{
+		/*
+			// Usually one per function.
+		*/
+		if (select_path(path))
+			paths.insert(path);
+	}
+}
+
+/**
+	// Print the collected paths in sorted order.
+*/
+static int
+sources_finish(FILE *fp, StringSet<> &paths)
+{
+	Measure m(phase_output);
+	Writer w(fp);
+	std::vector<StringRef> sorted;
+
+	sorted.reserve(paths.size());
+	for (const auto &entry : paths)
+		sorted.push_back(entry.getKey());
+	std::sort(sorted.begin(), sorted.end());
+
+	for (auto path : sorted)
+	{
+		w.put(path).put('\n');
+	}
+
+	return(w.flush() != 0);
+}
+
+/**
+	// Read the mapping records of the &images, calling &observe with the index
+	// of the image and each record read from it.
+*/
+template <typename Observe>
+static int
+read_records(char *arch, int nimages, char **images, Observe observe)
+{
+	Measure m(phase_records);
+
+	for (int i = 0; i < nimages; ++i)
+	{
+		auto CounterMappingBuff = MemoryBuffer::getFile(images[i]);
+
+		if (std::error_code EC = CounterMappingBuff.getError())
+		{
+			fprintf(stderr, "%s: %s\n", images[i], EC.message().c_str());
+			return(1);
+		}
+
+		POSTv9(SmallVector<std::unique_ptr<MemoryBuffer>, 4> bufs);
+
+		auto CoverageReaderOrErr = CREATE_READER(CounterMappingBuff.get(), arch, bufs);
+		if (!CoverageReaderOrErr)
+		{
+			if (auto E = CRE_GET_ERROR(CoverageReaderOrErr))
+			{
+				fprintf(stderr, "%s\n", ERR_STRING(E));
+				return(1);
+			}
+
+			fprintf(stderr, "failed to load counter mapping reader from object\n");
+			return(1);
+		}
+
+		ITER_CR_RECORDS(R, CoverageReaderOrErr.get())
+		{
+			if (auto E = CMR_GET_ERROR(R))
+				continue;
+
+			++stats.records;
+
+			m.suspend();
+			{
+				Measure o(phase_output);
+				observe(i, RECORD(R));
+			}
+			m.resume();
+		}
+		ITER_CR_CLOSE()
+	}
+
+	return(0);
+}
+
+/**
+	// Identify the regions of the sources that may have counts.
+*/
+int
+print_regions(FILE *fp, char *arch, int nimages, char **images)
+{
+	struct Regions rs;
+	int image = -1, last = -1;
+
+	rs.out.attach(fp);
+
+	int r = read_records(arch, nimages, images,
+		[&](int i, const coverage::CoverageMappingRecord &record) {
+			if (i != image)
+			{
+				image = i;
+				last = -1;
+			}
+
+			regions_record(&rs, record, &last);
+		});
+
+	if (r != 0)
+		return(r);
+
+	return(regions_finish(fp, &rs));
+}
+
+/**
+	// Identify the set of source files associated with the images.
+*/
+int
+print_sources(FILE *fp, char *arch, int nimages, char **images)
+{
+	StringSet<> paths;
+
+	int r = read_records(arch, nimages, images,
+		[&](int, const coverage::CoverageMappingRecord &record) {
+			sources_record(paths, record);
+		});
+
+	if (r != 0)
+		return(r);
+
+	return(sources_finish(fp, paths));
+}
+
+/**
+	// Bounded memory aggregation of keyed values for the streaming mode, -M.
+
+	// Keys are accumulated in memory with their values summed until the estimated
+	// size of the batch reaches the ceiling. The batch is then sorted and written
+	// to a temporary file as a run, and &Spill::merge combines the runs, summing
+	// the values of equal keys, and gives the keys to the callback in order.
+*/
+class Spill
+{
+	struct Run {
+		FILE *fp;
+		std::string key;
+		uint64_t value;
+	};
+
+	size_t ceiling;
+	size_t size;
+	StringMap<uint64_t> batch;
+	std::vector<FILE *> runs;
+
+	std::vector<StringRef>
+	sorted()
+	{
+		std::vector<StringRef> keys;
+
+		keys.reserve(batch.size());
+		for (const auto &entry : batch)
+			keys.push_back(entry.getKey());
+		std::sort(keys.begin(), keys.end());
+
+		return(keys);
+	}
+
+	int
+	flush()
+	{
+		FILE *fp = tmpfile();
+
+		if (fp == NULL)
+		{
+			fprintf(stderr, "failed to create spill file: %s\n", strerror(errno));
+			return(-1);
+		}
+
+		for (auto key : sorted())
+		{
+			uint32_t n = key.size();
+			uint64_t v = batch[key];
+
+			fwrite(&n, sizeof(n), 1, fp);
+			fwrite(key.data(), 1, n, fp);
+			fwrite(&v, sizeof(v), 1, fp);
+		}
+
+		if (fflush(fp) != 0 || ferror(fp))
+		{
+			fprintf(stderr, "failed to write spill file: %s\n", strerror(errno));
+			fclose(fp);
+			return(-1);
+		}
+
+		rewind(fp);
+		runs.push_back(fp);
+		batch.clear();
+		size = 0;
+
+		return(0);
+	}
+
+	static bool
+	next(struct Run *r)
+	{
+		uint32_t n;
+
+		if (fread(&n, sizeof(n), 1, r->fp) != 1)
+			return(false);
+
+		r->key.resize(n);
+		if (n > 0 && fread(&r->key[0], 1, n, r->fp) != n)
+			return(false);
+		if (fread(&r->value, sizeof(r->value), 1, r->fp) != 1)
+			return(false);
+
+		return(true);
+	}
+
+public:
+	Spill(size_t limit) : ceiling(limit), size(0)
+	{
+	}
+
+	~Spill()
+	{
+		for (auto fp : runs)
+			fclose(fp);
+	}
+
+	int
+	add(StringRef key, uint64_t value)
+	{
+		auto r = batch.insert(std::make_pair(key, value));
+
+		if (!r.second)
+			r.first->second += value;
+		else
+		{
+			/* Key, entry, and bucket overhead. */
+			size += key.size() + sizeof(StringMapEntry<uint64_t>) + 2 * sizeof(void *);
+
+			if (size >= ceiling)
+				return(flush());
+		}
+
+		return(0);
+	}
+
+	template <typename Emit>
+	int
+	merge(Emit emit)
+	{
+		if (runs.empty())
+		{
+			for (auto key : sorted())
+				emit(key, batch[key]);
+
+			return(0);
+		}
+
+		if (!batch.empty() && flush() != 0)
+			return(-1);
+
+		std::vector<struct Run> heads(runs.size());
+		std::vector<size_t> heap;
+		auto after = [&](size_t a, size_t b) { return(heads[a].key > heads[b].key); };
+
+		for (size_t i = 0; i < runs.size(); ++i)
+		{
+			heads[i].fp = runs[i];
+			if (next(&heads[i]))
+				heap.push_back(i);
+		}
+		std::make_heap(heap.begin(), heap.end(), after);
+
+		while (!heap.empty())
+		{
+			std::string key = heads[heap.front()].key;
+			uint64_t value = 0;
+
+			/* Combine the equal keys of every run. */
+			while (!heap.empty() && heads[heap.front()].key == key)
+			{
+				size_t i = heap.front();
+
+				std::pop_heap(heap.begin(), heap.end(), after);
+				heap.pop_back();
+				value += heads[i].value;
+
+				if (next(&heads[i]))
+				{
+					heap.push_back(i);
+					std::push_heap(heap.begin(), heap.end(), after);
+				}
+			}
+
+			emit(StringRef(key), value);
+		}
+
+		return(0);
+	}
+};
+
+/**
+	// Streaming sources; the distinct paths are spilled to sorted runs
+	// whenever the batch reaches the memory ceiling.
+*/
+int
+stream_sources(FILE *fp, char *arch, int nimages, char **images)
+{
+	Spill spill(options.ceiling);
+	int failed = 0;
+
+	int r = read_records(arch, nimages, images,
+		[&](int, const coverage::CoverageMappingRecord &record) {
+			if (failed || !select_function(record.FunctionName))
+				return;
+
+			for (const auto path : record.Filenames)
+			{
+				if (select_path(path))
+					failed |= spill.add(path, 0);
+			}
+		});
+
+	if (r != 0 || failed)
+		return(1);
+
+	Measure m(phase_output);
+	Writer w(fp);
+
+	if (spill.merge([&](StringRef path, uint64_t) { w.put(path).put('\n'); }) != 0)
+		return(1);
+
+	return(w.flush() != 0);
+}
+
+#if (LLVM_VERSION_MAJOR >= 9)
+/**
+	// Coverage mapping reader that observes the records read by CoverageMapping::load
+	// so that the sources and regions can be written while the mapping is constructed.
+*/
+class ObservedReader : public coverage::CoverageMappingReader
+{
+	std::unique_ptr<coverage::CoverageMappingReader> reader;
+	struct Regions *rs;
+	StringSet<> *paths;
+	int last;
+
+public:
+	ObservedReader(std::unique_ptr<coverage::CoverageMappingReader> r,
+		struct Regions *regions, StringSet<> *sources)
+		: reader(std::move(r)), rs(regions), paths(sources), last(-1)
+	{
+	}
+
+	Error
+	readNextRecord(coverage::CoverageMappingRecord &record) override
+	{
+		Error E = reader->readNextRecord(record);
+
+		if (!E)
+		{
+			sources_record(*paths, record);
+			regions_record(rs, record, &last);
+		}
+
+		return(E);
+	}
+};
+
+static FILE *
+open_output(const char *path, const char *mode)
+{
+	FILE *fp;
+
+	if (strcmp(path, "-") == 0)
+		return(stats_output(compressed_output(stdout)));
+
+	fp = fopen(path, mode);
+	if (fp == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return(NULL);
+	}
+
+	return(stats_output(compressed_output(fp)));
+}
+
+static int
+close_output(FILE *fp)
+{
+	if (fp == stdout)
+		return(fflush(fp));
+
+	return(fclose(fp));
+}
+
+/**
+	// Identify the sources, regions, and counters of the &images with a single read
+	// of the images and &datafile. The datasets are written to the given paths.
+*/
+int
+print_all(char *sources_path, char *regions_path, char *counters_path,
+	char *arch, int nimages, char **images, char *datafile)
+{
+	struct Regions rs;
+	struct Readers readers;
+	StringSet<> paths;
+	FILE *sfp, *rfp, *cfp;
+	int r = 0;
+
+	if (open_readers(&readers, arch, nimages, images) != 0)
+		return(1);
+
+	auto profile = load_profile(datafile);
+	if (!profile)
+		return(1);
+
+	if ((sfp = open_output(sources_path, "w")) == NULL)
+		return(1);
+	if ((rfp = open_output(regions_path, "w")) == NULL)
+		return(1);
+	rs.out.attach(rfp);
+	if ((cfp = open_output(counters_path, "w")) == NULL)
+		return(1);
+
+	/*
+		// Wrap the readers so that the records are printed as they are loaded.
+		// Each wrapper tracks its own file identifier as print_regions does per image.
+	*/
+	for (auto &reader : readers.readers)
+		reader.reset(new ObservedReader(std::move(reader), &rs, &paths));
+
+	auto mapping = coverage::CoverageMapping::load(readers.readers, *profile);
+	if (auto E = CRE_GET_ERROR(mapping))
+	{
+		fprintf(stderr, "%s\n", ERR_STRING(E));
+		return(1);
+	}
+
+	r |= sources_finish(sfp, paths);
+	r |= regions_finish(rfp, &rs);
+	r |= write_counters(cfp, *mapping.get());
+
+	r |= close_output(sfp) != 0;
+	r |= close_output(rfp) != 0;
+	r |= close_output(cfp) != 0;
+
+	return(r);
+}
+
+/**
+	// Retrieve the counters of a function from &profile.
+	// Functions absent from the profile were not executed and have zero counts.
+	// Returns false when the function's hash does not match the profile's record.
+*/
+static bool
+profile_counts(IndexedInstrProfReader &profile, const coverage::CoverageMappingRecord &record,
+	std::vector<uint64_t> &counts)
+{
+	counts.clear();
+
+	if (Error E = profile.getFunctionCounts(record.FunctionName, record.FunctionHash, counts))
+	{
+		instrprof_error IPE = InstrProfError::take(std::move(E));
+
+		if (IPE != instrprof_error::unknown_function)
+			return(false);
+	}
+
+	return(true);
+}
+
+/**
+	// Evaluate the count of a region; zero when the counter cannot be evaluated.
+*/
+static uint64_t
+region_count(const coverage::CounterMappingContext &ctx, const coverage::CounterMappingRegion &region)
+{
+	auto v = ctx.evaluate(region.Count);
+
+	if (!v)
+	{
+		consumeError(v.takeError());
+		return(0);
+	}
+
+	return(*v < 0 ? 0 : (uint64_t) *v);
+}
+
+/**
+	// Print the regions whose counts differ between the &baseline and &candidate
+	// profiles for the mapping records of the &images.
+
+	// Functions are printed as `@name hash` when they have changed regions, followed by
+	// the `fileid:path` lines of print_regions and `index line column end-line end-column
+	// baseline candidate delta relative` lines. The function hash and the region index
+	// identify a region across runs; relative is `inf` when the baseline count is zero.
+*/
+int
+print_diff(FILE *fp, char *arch, int nimages, char **images, char *baseline, char *candidate)
+{
+	std::set<std::pair<std::string, uint64_t>> functions;
+	std::vector<uint64_t> bcounts, ccounts;
+	unsigned long mismatched = 0;
+	int image = -1, last = -1;
+
+	auto bprofile = load_profile(baseline);
+	if (!bprofile)
+		return(1);
+	auto cprofile = load_profile(candidate);
+	if (!cprofile)
+		return(1);
+
+	int r = read_records(arch, nimages, images,
+		[&](int i, const coverage::CoverageMappingRecord &record) {
+			auto fname = record.FunctionName;
+			bool opened = false;
+
+			if (i != image)
+			{
+				image = i;
+				last = -1;
+			}
+
+			if (!select_function(fname))
+				return;
+
+			auto selected = select_record_files(record.Filenames);
+			if (selected.none())
+				return;
+
+			if (!functions.emplace((std::string) fname, record.FunctionHash).second)
+				return;
+
+			if (!profile_counts(*bprofile, record, bcounts) || !profile_counts(*cprofile, record, ccounts))
+			{
+				++mismatched;
+				return;
+			}
+
+			coverage::CounterMappingContext bctx(record.Expressions, bcounts);
+			coverage::CounterMappingContext cctx(record.Expressions, ccounts);
+
+			for (size_t ri = 0; ri < record.MappingRegions.size(); ++ri)
+			{
+				const auto &region = record.MappingRegions[ri];
+				auto fi = region.FileID;
+
+				if (!selected[fi])
+					continue;
+
+				uint64_t bc = region_count(bctx, region);
+				uint64_t cc = region_count(cctx, region);
+				if (bc == cc)
+					continue;
+
+				if (!opened)
+				{
+					fprintf(fp, "@%.*s %llu\n", (int) fname.size(), fname.data(),
+						(unsigned long long) record.FunctionHash);
+					opened = true;
+					last = -1;
+				}
+
+				if ((int) fi != last)
+				{
+					StringRef fn = record.Filenames[fi];
+					fprintf(fp, "%lu:%.*s\n", (unsigned long) fi, (int) fn.size(), fn.data());
+					last = fi;
+				}
+
+				fprintf(fp, "%lu %lu %lu %lu %lu %llu %llu %lld ",
+					(unsigned long) ri,
+					(unsigned long) region.LineStart,
+					(unsigned long) region.ColumnStart,
+					(unsigned long) region.LineEnd,
+					(unsigned long) region.ColumnEnd,
+					(unsigned long long) bc, (unsigned long long) cc,
+					(long long) (cc - bc));
+
+				if (bc == 0)
+					fprintf(fp, "inf\n");
+				else
+					fprintf(fp, "%.6g\n", ((double) cc - (double) bc) / (double) bc);
+			}
+		});
+
+	if (mismatched > 0)
+		fprintf(stderr, "%lu functions skipped due to profile hash mismatches\n", mismatched);
+
+	return(r);
+}
+
+/**
+	// Append &v to &key as a big endian integer so that keys sort numerically.
+*/
+static void
+key_number(std::string &key, uint32_t v)
+{
+	char b[4] = {(char) (v >> 24), (char) (v >> 16), (char) (v >> 8), (char) v};
+	key.append(b, 4);
+}
+
+static uint32_t
+key_read(const char *p)
+{
+	const unsigned char *b = (const unsigned char *) p;
+	return(((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | ((uint32_t) b[2] << 8) | b[3]);
+}
+
+/**
+	// Assign the spill key of &region in &path to &key: the path, a NUL, the
+	// start and inverted end so that enclosing regions sort before those they
+	// contain, and the kind so that identical regions of each kind are summed apart.
+*/
+static void
+region_key(std::string &key, StringRef path, const coverage::CounterMappingRegion &region)
+{
+	key.assign(path.data(), path.size());
+	key.push_back('\0');
+	key_number(key, region.LineStart);
+	key_number(key, region.ColumnStart);
+	key_number(key, ~region.LineEnd);
+	key_number(key, ~region.ColumnEnd);
+	key.push_back((char) region.Kind);
+}
+
+/**
+	// Size of the position and kind suffix of the keys built by &region_key.
+*/
+static constexpr size_t region_key_suffix = 1 + 16 + 1;
+
+/**
+	// Add the counts of the regions of the selected functions and files that
+	// &accept admits to &spill; the counts are evaluated from the function
+	// records and the profile, &datafile, and each function is added once.
+
+	// Functions are identified by the MD5 of their name, as the indexed profile
+	// identifies them, and their structural hash, so sixteen bytes are retained
+	// for each function outside of the ceiling of -M regardless of the names'
+	// lengths. Names whose MD5s collide are already indistinguishable to the
+	// profile; the records after the first are skipped as duplicates.
+*/
+template <typename Accept>
+static int
+spill_regions(Spill &spill, char *arch, int nimages, char **images, char *datafile, Accept accept)
+{
+	DenseSet<std::pair<uint64_t, uint64_t>> functions;
+	std::vector<uint64_t> counts;
+	std::string key;
+	unsigned long mismatched = 0;
+	int failed = 0;
+
+	auto profile = load_profile(datafile);
+	if (!profile)
+		return(1);
+
+	int r = read_records(arch, nimages, images,
+		[&](int, const coverage::CoverageMappingRecord &record) {
+			if (failed || !select_function(record.FunctionName))
+				return;
+
+			auto selected = select_record_files(record.Filenames);
+			if (selected.none())
+				return;
+
+			auto identity = std::make_pair(IndexedInstrProf::ComputeHash(record.FunctionName), record.FunctionHash);
+			if (!functions.insert(identity).second)
+				return;
+
+			if (!profile_counts(*profile, record, counts))
+			{
+				++mismatched;
+				return;
+			}
+
+			coverage::CounterMappingContext ctx(record.Expressions, counts);
+
+			for (const auto &region : record.MappingRegions)
+			{
+				if (!selected[region.FileID] || !accept(region.Kind))
+					continue;
+
+				region_key(key, record.Filenames[region.FileID], region);
+				failed |= spill.add(key, region_count(ctx, region));
+			}
+		});
+
+	if (mismatched > 0)
+		fprintf(stderr, "%lu functions skipped due to profile hash mismatches\n", mismatched);
+
+	return(r != 0 || failed);
+}
+
+/**
+	// Streaming counters; the counts of the regions are evaluated directly
+	// from the function records and the profile, so the coverage mapping is never
+	// materialized and only the functions' identities are retained.
+
+	// The code, expansion, skipped, and gap regions are keyed by file, start,
+	// inverted end, and kind, and the identical regions of function instantiations
+	// are summed. The merged regions of one file at a time are given to
+	// &SegmentBuilder, so the entries, including those of zero length regions
+	// inside of gaps, are those of the segments of getCoverageForFile.
+*/
+int
+stream_counters(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	Spill spill(options.ceiling);
+
+	if (options.format != format_text || options.branches)
+	{
+		fprintf(stderr, "streaming counters are only available in the text format without -B\n");
+		return(1);
+	}
+
+	int r = spill_regions(spill, arch, nimages, images, datafile,
+		[](coverage::CounterMappingRegion::RegionKind kind) {
+			return(segment_kind(kind));
+		});
+
+	if (r != 0)
+		return(1);
+
+	Measure m(phase_output);
+	Writer w(fp);
+	std::string file;
+	std::vector<coverage::CountedRegion> regions;
+
+	auto finish = [&]() {
+		if (regions.empty())
+			return;
+
+		struct FunctionCoverage fc;
+
+		fc.segments = SegmentBuilder::segments_of(regions);
+		++stats.files;
+		stats.segments += fc.segments.size();
+		if (!fc.empty())
+			print_file_counters(w, file, fc);
+		regions.clear();
+	};
+
+	r = spill.merge([&](StringRef k, uint64_t v) {
+		size_t n = k.size() - region_key_suffix;
+		StringRef path = k.substr(0, n);
+		const char *span = k.data() + n + 1;
+
+		if (path != file)
+		{
+			finish();
+			file.assign(path.data(), path.size());
+		}
+
+		auto region = coverage::CounterMappingRegion::makeRegion(coverage::Counter::getZero(), 0,
+			key_read(span), key_read(span + 4), ~key_read(span + 8), ~key_read(span + 12));
+		region.Kind = (coverage::CounterMappingRegion::RegionKind) span[16];
+		regions.emplace_back(region, v);
+	});
+	finish();
+
+	if (r != 0)
+		return(1);
+
+	return(w.flush() != 0);
+}
+
+/**
+	// Print the code regions whose counts are zero with their extents; with -A,
+	// every code region is printed with its count.
+
+	// The counts are evaluated from the function records and the profile, and the
+	// identical regions of function instantiations are summed so that a region is
+	// only reported as uncovered when none of the instantiations executed it.
+	// Files are printed as `@path` followed by `line column end-line end-column count`
+	// lines ordered by start with enclosing regions first. The regions are
+	// aggregated with the streaming mode's spill, so -M bounds the memory used.
+*/
+int
+print_uncovered(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	Spill spill(options.ceiling > 0 ? options.ceiling : SIZE_MAX);
+
+	int r = spill_regions(spill, arch, nimages, images, datafile,
+		[](coverage::CounterMappingRegion::RegionKind kind) {
+			return(kind == coverage::CounterMappingRegion::CodeRegion);
+		});
+
+	if (r != 0)
+		return(1);
+
+	Measure m(phase_output);
+	Writer w(fp);
+	std::string file;
+	bool opened = false;
+
+	r = spill.merge([&](StringRef k, uint64_t v) {
+		size_t n = k.size() - region_key_suffix;
+		StringRef path = k.substr(0, n);
+		const char *span = k.data() + n + 1;
+
+		if (v > 0 && !options.all)
+			return;
+
+		if (!opened || path != file)
+		{
+			opened = true;
+			file.assign(path.data(), path.size());
+			w.put('@').put(path).put('\n');
+		}
+
+		w.number(key_read(span)).put(' ').number(key_read(span + 4)).put(' ');
+		w.number(~key_read(span + 8)).put(' ').number(~key_read(span + 12)).put(' ');
+		w.number(v).put('\n');
+	});
+
+	if (r != 0)
+		return(1);
+
+	return(w.flush() != 0);
+}
+
+/**
+	// Entry of the &print_hot heaps.
+*/
+struct Hot {
+	uint64_t count;
+	uint32_t line, column, end_line, end_column;
+	std::string function;
+	std::string path;
+
+	bool
+	operator<(const struct Hot &h) const
+	{
+		/* Inverted so that the heap's front is the least count. */
+		return(count > h.count);
+	}
+};
+
+/**
+	// Add &h to the bounded heap, &heap, when it is one of the &limit greatest counts.
+*/
+static void
+hot_offer(std::vector<struct Hot> &heap, size_t limit, uint64_t count,
+	const coverage::CounterMappingRegion &region, StringRef function, StringRef path)
+{
+	if (heap.size() >= limit && count <= heap.front().count)
+		return;
+
+	struct Hot h = {
+		count,
+		region.LineStart, region.ColumnStart, region.LineEnd, region.ColumnEnd,
+		function.str(), path.str(),
+	};
+
+	if (heap.size() >= limit)
+	{
+		std::pop_heap(heap.begin(), heap.end());
+		heap.back() = std::move(h);
+	}
+	else
+		heap.push_back(std::move(h));
+
+	std::push_heap(heap.begin(), heap.end());
+}
+
+/**
+	// Print the &limit most executed code regions and functions.
+
+	// The counts are evaluated from the function records and the profile
+	// while only the current leaders are retained. Regions are printed as
+	// `r count line column end-line end-column function path` lines followed
+	// by the functions' `f` lines describing their entry regions; both in
+	// descending order of count. Instantiations are reported individually.
+*/
+int
+print_hot(FILE *fp, unsigned long limit, char *arch, int nimages, char **images, char *datafile)
+{
+	std::set<std::pair<std::string, uint64_t>> functions;
+	std::vector<struct Hot> regions, entries;
+	std::vector<uint64_t> counts;
+	unsigned long mismatched = 0;
+
+	if (limit == 0)
+	{
+		fprintf(stderr, "hot requires a positive limit\n");
+		return(1);
+	}
+
+	auto profile = load_profile(datafile);
+	if (!profile)
+		return(1);
+
+	int r = read_records(arch, nimages, images,
+		[&](int, const coverage::CoverageMappingRecord &record) {
+			auto fname = record.FunctionName;
+
+			if (!select_function(fname))
+				return;
+
+			auto selected = select_record_files(record.Filenames);
+			if (selected.none() || record.MappingRegions.empty())
+				return;
+
+			if (!functions.emplace((std::string) fname, record.FunctionHash).second)
+				return;
+
+			if (!profile_counts(*profile, record, counts))
+			{
+				++mismatched;
+				return;
+			}
+
+			coverage::CounterMappingContext ctx(record.Expressions, counts);
+			const auto &entry = record.MappingRegions.front();
+			uint64_t executions = region_count(ctx, entry);
+
+			if (executions == 0)
+				return;
+
+			if (selected[entry.FileID])
+				hot_offer(entries, limit, executions, entry, fname, record.Filenames[entry.FileID]);
+
+			for (const auto &region : record.MappingRegions)
+			{
+				if (!selected[region.FileID] || region.Kind != coverage::CounterMappingRegion::CodeRegion)
+					continue;
+
+				uint64_t count = region_count(ctx, region);
+				if (count > 0)
+					hot_offer(regions, limit, count, region, fname, record.Filenames[region.FileID]);
+			}
+		});
+
+	if (mismatched > 0)
+		fprintf(stderr, "%lu functions skipped due to profile hash mismatches\n", mismatched);
+	if (r != 0)
+		return(r);
+
+	Measure m(phase_output);
+	Writer w(fp);
+	const std::pair<char, std::vector<struct Hot> *> reports[] = {{'r', &regions}, {'f', &entries}};
+
+	for (const auto &report : reports)
+	{
+		std::sort_heap(report.second->begin(), report.second->end());
+
+		for (const auto &h : *report.second)
+		{
+			w.put(report.first).put(' ').number(h.count).put(' ');
+			w.number(h.line).put(' ').number(h.column).put(' ');
+			w.number(h.end_line).put(' ').number(h.end_column).put(' ');
+			w.put(h.function).put(' ').put(h.path).put('\n');
+		}
+	}
+
+	return(w.flush() != 0);
+}
+#else
+int
+print_all(char *sources_path, char *regions_path, char *counters_path,
+	char *arch, int nimages, char **images, char *datafile)
+{
+	fprintf(stderr, "all requires LLVM 9 or later\n");
+	return(1);
+}
+
+int
+print_diff(FILE *fp, char *arch, int nimages, char **images, char *baseline, char *candidate)
+{
+	fprintf(stderr, "diff requires LLVM 9 or later\n");
+	return(1);
+}
+
+int
+stream_counters(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	fprintf(stderr, "streaming counters require LLVM 9 or later\n");
+	return(1);
+}
+
+int
+print_uncovered(FILE *fp, char *arch, int nimages, char **images, char *datafile)
+{
+	fprintf(stderr, "uncovered requires LLVM 9 or later\n");
+	return(1);
+}
+
+int
+print_hot(FILE *fp, unsigned long limit, char *arch, int nimages, char **images, char *datafile)
+{
+	fprintf(stderr, "hot requires LLVM 9 or later\n");
+	return(1);
+}
+#endif
+
+#if (LLVM_VERSION_MAJOR >= 10)
+/**
+	// Persistent coverage store.
+
+	// A store is a directory of image identifiers. Each identifier's directory holds
+	// the region table of the images in the binary format, `regions`, an index of the
+	// table's sections by file and function, `index`, the counter vectors appended for
+	// every profile, `counts`, and their sum, `total`. Counter vectors have a value
+	// for every row of the region table, so queries are answered from the table
+	// and the total without reading the images or the profiles again.
+*/
+struct IndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t order;
+
+	uint64_t files;
+	uint64_t functions;
+	uint64_t file_sections;
+	uint64_t function_sections;
+};
+
+/**
+	// The sections of a file or function string; &start is the
+	// position of the entry's first section identifier.
+*/
+struct IndexEntry {
+	uint32_t string;
+	uint32_t count;
+	uint64_t start;
+};
+
+/**
+	// Header of an appended counter vector; the profile path and
+	// padding to an eight byte boundary precede the counts.
+*/
+struct CountsHeader {
+	char magic[8];
+	uint64_t rows;
+	int64_t time;
+	uint64_t source;
+};
+
+/**
+	// Mapped files of a stored identifier.
+*/
+struct Store {
+	std::unique_ptr<MemoryBuffer> regions, index, total;
+
+	const struct ColumnsHeader *columns;
+	const struct IndexHeader *header;
+
+	const char *
+	at(uint64_t offset) const
+	{
+		return(regions->getBufferStart() + offset);
+	}
+
+	StringRef
+	string(uint32_t i) const
+	{
+		const uint64_t *offsets = (const uint64_t *) at(columns->string_offsets);
+		return(StringRef(at(columns->string_data) + offsets[i], offsets[i+1] - offsets[i] - 1));
+	}
+
+	const struct ColumnsSection *
+	sections() const
+	{
+		return((const struct ColumnsSection *) at(columns->section_table));
+	}
+
+	const struct IndexEntry *
+	files() const
+	{
+		return((const struct IndexEntry *) (index->getBufferStart() + sizeof(struct IndexHeader)));
+	}
+
+	const struct IndexEntry *
+	functions() const
+	{
+		return(files() + header->files);
+	}
+
+	/**
+		// The section identifiers of an entry.
+	*/
+	ArrayRef<uint32_t>
+	identifiers(const struct IndexEntry &e) const
+	{
+		const uint32_t *ids = (const uint32_t *) (functions() + header->functions);
+		return(makeArrayRef(ids + e.start, e.count));
+	}
+
+	const uint64_t *
+	counts() const
+	{
+		return((const uint64_t *) total->getBufferStart());
+	}
+};
+
+static std::string
+hex(ArrayRef<uint8_t> data)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string r;
+
+	for (auto b : data)
+	{
+		r.push_back(digits[b >> 4]);
+		r.push_back(digits[b & 0xF]);
+	}
+
+	return(r);
+}
+
+/**
+	// Identify an image by its GNU build-id note or Mach-O UUID; images
+	// without either are identified by the MD5 digest of their contents.
+*/
+static std::string
+image_identifier(const char *path)
+{
+	auto buffer = MemoryBuffer::getFile(path);
+
+	if (std::error_code EC = buffer.getError())
+	{
+		fprintf(stderr, "%s: %s\n", path, EC.message().c_str());
+		return(std::string());
+	}
+
+	auto object = object::ObjectFile::createObjectFile(buffer.get()->getMemBufferRef());
+	if (!object)
+		consumeError(object.takeError());
+	else if (auto *macho = dyn_cast<object::MachOObjectFile>(object->get()))
+	{
+		auto uuid = macho->getUuid();
+		if (!uuid.empty())
+			return(hex(uuid));
+	}
+	else
+	{
+		bool le = (*object)->isLittleEndian();
+
+		for (const auto &section : (*object)->sections())
+		{
+			auto name = section.getName();
+			if (!name)
+			{
+				consumeError(name.takeError());
+				continue;
+			}
+
+			if (*name != ".note.gnu.build-id")
+				continue;
+
+			auto contents = section.getContents();
+			if (!contents)
+			{
+				consumeError(contents.takeError());
+				continue;
+			}
+
+			/* namesz, descsz, and type followed by the padded name and the descriptor. */
+			StringRef note = *contents;
+			if (note.size() < 12)
+				continue;
+
+			uint32_t namesz = le ? support::endian::read32le(note.data()) : support::endian::read32be(note.data());
+			uint32_t descsz = le ? support::endian::read32le(note.data() + 4) : support::endian::read32be(note.data() + 4);
+			size_t desc = 12 + alignTo(namesz, 4);
+
+			if (descsz > 0 && desc + descsz <= note.size())
+				return(hex(makeArrayRef((const uint8_t *) note.data() + desc, descsz)));
+		}
+	}
+
+	MD5 md5;
+	MD5::MD5Result digest;
+
+	md5.update(buffer.get()->getBuffer());
+	md5.final(digest);
+	return(std::string(digest.digest().str()));
+}
+
+/**
+	// The identifier of a set of images; the identifiers of multiple images are joined by `+`.
+*/
+static std::string
+store_identifier(int nimages, char **images)
+{
+	std::string id;
+
+	for (int i = 0; i < nimages; ++i)
+	{
+		std::string iid = image_identifier(images[i]);
+
+		if (iid.empty())
+			return(iid);
+
+		if (i > 0)
+			id.push_back('+');
+		id.append(iid);
+	}
+
+	return(id);
+}
+
+/**
+	// Write &size bytes to &path by way of a temporary file so that
+	// readers never observe a partial file.
+*/
+static int
+store_replace(const std::string &path, const char *data, size_t size)
+{
+	std::string tmp = path + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+
+	if (fp == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", tmp.c_str(), strerror(errno));
+		return(1);
+	}
+
+	fwrite(data, 1, size, fp);
+	if (ferror(fp) || fclose(fp) != 0 || rename(tmp.c_str(), path.c_str()) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+		return(1);
+	}
+
+	return(0);
+}
+
+/**
+	// Construct the file and function index of a region table.
+*/
+static std::string
+store_index(const struct Columns *c)
+{
+	std::map<uint32_t, std::vector<uint32_t>> files, functions;
+	struct IndexHeader h;
+	uint64_t start = 0;
+	std::string r;
+
+	for (size_t i = 0; i < c->sections.size(); ++i)
+	{
+		files[c->sections[i].file].push_back(i);
+		if (c->sections[i].function != UINT32_MAX)
+			functions[c->sections[i].function].push_back(i);
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "ipqidx", 7);
+	h.version = 1;
+	h.order = 0x01020304;
+	h.files = files.size();
+	h.functions = functions.size();
+	h.file_sections = c->sections.size();
+	for (const auto &f : functions)
+		h.function_sections += f.second.size();
+
+	r.append((const char *) &h, sizeof(h));
+
+	for (const auto *index : {&files, &functions})
+	{
+		for (const auto &entry : *index)
+		{
+			struct IndexEntry e = {entry.first, (uint32_t) entry.second.size(), start};
+			r.append((const char *) &e, sizeof(e));
+			start += entry.second.size();
+		}
+	}
+
+	for (const auto *index : {&files, &functions})
+	{
+		for (const auto &entry : *index)
+			r.append((const char *) entry.second.data(), entry.second.size() * sizeof(uint32_t));
+	}
+
+	return(r);
+}
+
+/**
+	// Map the files of the identifier directory, &dir; the total is
+	// only mapped when &totals is set.
+*/
+static int
+store_open(struct Store *st, const std::string &dir, bool totals = true)
+{
+	std::unique_ptr<MemoryBuffer> *buffers[] = {&st->regions, &st->index, &st->total};
+	const char *names[] = {"regions", "index", "total"};
+
+	for (int i = 0; i < (totals ? 3 : 2); ++i)
+	{
+		std::string path = dir + "/" + names[i];
+		auto buffer = MemoryBuffer::getFile(path);
+
+		if (std::error_code EC = buffer.getError())
+		{
+			fprintf(stderr, "%s: %s\n", path.c_str(), EC.message().c_str());
+			return(1);
+		}
+
+		*buffers[i] = std::move(buffer.get());
+	}
+
+	st->columns = (const struct ColumnsHeader *) st->regions->getBufferStart();
+	st->header = (const struct IndexHeader *) st->index->getBufferStart();
+
+	if (st->regions->getBufferSize() < sizeof(struct ColumnsHeader)
+		|| memcmp(st->columns->magic, "ipqcols", 8) != 0
+		|| st->columns->order != 0x01020304
+		|| st->index->getBufferSize() < sizeof(struct IndexHeader)
+		|| memcmp(st->header->magic, "ipqidx", 7) != 0
+		|| st->header->order != 0x01020304
+		|| (totals && st->total->getBufferSize() != st->columns->rows * sizeof(uint64_t)))
+	{
+		fprintf(stderr, "%s: invalid or incompatible coverage store\n", dir.c_str());
+		return(1);
+	}
+
+	return(0);
+}
+
+/**
+	// Write the index, an empty total when &totals is set, and the region table of a
+	// new identifier. The region table is written last as its presence marks a
+	// complete identifier.
+*/
+static int
+store_create(const std::string &dir, struct Columns *c, bool totals = true)
+{
+	std::string index = store_index(c);
+	std::vector<uint64_t> zeros(totals ? c->count.size() : 0, 0);
+	std::string path = dir + "/regions";
+	std::string tmp = path + ".tmp";
+	FILE *fp;
+
+	if (store_replace(dir + "/index", index.data(), index.size()) != 0)
+		return(1);
+	if (totals && store_replace(dir + "/total", (const char *) zeros.data(), zeros.size() * sizeof(uint64_t)) != 0)
+		return(1);
+
+	if ((fp = fopen(tmp.c_str(), "wb")) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", tmp.c_str(), strerror(errno));
+		return(1);
+	}
+
+	if (columns_write(fp, c) != 0 || fclose(fp) != 0 || rename(tmp.c_str(), path.c_str()) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+		return(1);
+	}
+
+	return(0);
+}
+
+/**
+	// Append the counter vector of the profile, &source, and add it to the total.
+*/
+static int
+store_append(const std::string &dir, const char *source, std::vector<uint64_t> &vector)
+{
+	static const char padding[8] = {0};
+	struct Store st;
+	struct CountsHeader h;
+	std::string path = dir + "/counts";
+	size_t n = strlen(source);
+	FILE *fp;
+
+	if (store_open(&st, dir) != 0)
+		return(1);
+
+	if (st.columns->rows != vector.size())
+	{
+		fprintf(stderr, "%s: the stored region table has %llu rows, but the images have %zu regions\n",
+			dir.c_str(), (unsigned long long) st.columns->rows, vector.size());
+		return(1);
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "ipqcnts", 8);
+	h.rows = vector.size();
+	h.time = (int64_t) time(NULL);
+	h.source = n;
+
+	if ((fp = fopen(path.c_str(), "ab")) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+		return(1);
+	}
+
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(source, 1, n, fp);
+	fwrite(padding, 1, (8 - (n % 8)) % 8, fp);
+	fwrite(vector.data(), sizeof(uint64_t), vector.size(), fp);
+
+	if (ferror(fp) || fclose(fp) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+		return(1);
+	}
+
+	for (size_t i = 0; i < vector.size(); ++i)
+		vector[i] += st.counts()[i];
+
+	return(store_replace(dir + "/total", (const char *) vector.data(), vector.size() * sizeof(uint64_t)));
+}
+
+/**
+	// Record the counters of &datafile in the store for the &images.
+
+	// The region table and index are written for the first profile of an identifier
+	// and contain every function regardless of the filters; the filters apply to the
+	// store's queries. Profiles are added under an exclusive lock of the identifier's
+	// directory, and the identifier is written to &fp.
+*/
+int
+store_add(FILE *fp, char *store, char *arch, int nimages, char **images, char *datafile)
+{
+	std::set<std::pair<std::string, uint64_t>> functions;
+	std::vector<uint64_t> counts, vector;
+	struct Columns columns;
+	unsigned long mismatched = 0;
+	std::string id, dir;
+	bool create;
+	int lock, r;
+
+	id = store_identifier(nimages, images);
+	if (id.empty())
+		return(1);
+
+	dir = std::string(store) + "/" + id;
+	for (const auto &path : {std::string(store), dir})
+	{
+		if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST)
+		{
+			fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+			return(1);
+		}
+	}
+
+	auto profile = load_profile(datafile);
+	if (!profile)
+		return(1);
+
+	lock = open((dir + "/lock").c_str(), O_RDWR|O_CREAT, 0666);
+	if (lock == -1 || flock(lock, LOCK_EX) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+		if (lock != -1)
+			close(lock);
+		return(1);
+	}
+
+	create = access((dir + "/regions").c_str(), F_OK) != 0;
+
+	r = read_records(arch, nimages, images,
+		[&](int, const coverage::CoverageMappingRecord &record) {
+			SmallBitVector selected(record.Filenames.size(), true);
+
+			if (!functions.emplace((std::string) record.FunctionName, record.FunctionHash).second)
+				return;
+
+			if (create)
+				columns_function_regions(&columns, record.FunctionName, record.Filenames, record.MappingRegions, selected);
+
+			bool matched = profile_counts(*profile, record, counts);
+			if (!matched)
+				++mismatched;
+
+			coverage::CounterMappingContext ctx(record.Expressions, counts);
+			for (const auto &region : record.MappingRegions)
+				vector.push_back(matched ? region_count(ctx, region) : 0);
+		});
+
+	if (mismatched > 0)
+		fprintf(stderr, "%lu functions stored without counts due to profile hash mismatches\n", mismatched);
+
+	if (r == 0 && create)
+		r = store_create(dir, &columns);
+	if (r == 0)
+		r = store_append(dir, datafile, vector);
+	if (r == 0)
+		fprintf(fp, "%s\n", id.c_str());
+
+	close(lock);
+	return(r);
+}
+
+/**
+	// Print the counters of the selected files, or the single &file, from the
+	// total of the identifier &id in the same form as the counters query.
+
+	// The code, expansion, skipped, and gap regions of a file are given to
+	// &SegmentBuilder with their totals, so identical regions of instantiations
+	// are summed and the entries are those of the segments of getCoverageForFile.
+*/
+int
+store_counters(FILE *fp, char *store, char *id, char *file)
+{
+	std::vector<const struct IndexEntry *> files;
+	std::vector<coverage::CountedRegion> regions;
+	struct Store st;
+
+	if (store_open(&st, std::string(store) + "/" + id) != 0)
+		return(1);
+
+	Measure m(phase_output);
+	Writer w(fp);
+	const uint32_t *line = (const uint32_t *) st.at(st.columns->line);
+	const uint32_t *column = (const uint32_t *) st.at(st.columns->column);
+	const uint32_t *end_line = (const uint32_t *) st.at(st.columns->end_line);
+	const uint32_t *end_column = (const uint32_t *) st.at(st.columns->end_column);
+	const uint8_t *kind = (const uint8_t *) st.at(st.columns->kind);
+
+	for (uint64_t i = 0; i < st.header->files; ++i)
+	{
+		StringRef path = st.string(st.files()[i].string);
+
+		if (file != NULL ? path == file : select_path(path))
+			files.push_back(&st.files()[i]);
+	}
+
+	std::sort(files.begin(), files.end(),
+		[&](const struct IndexEntry *a, const struct IndexEntry *b) {
+			return(st.string(a->string) < st.string(b->string));
+		});
+
+	for (const auto *e : files)
+	{
+		struct FunctionCoverage fc;
+
+		regions.clear();
+
+		for (auto si : st.identifiers(*e))
+		{
+			const auto &section = st.sections()[si];
+
+			for (uint64_t row = section.start; row < section.start + section.rows; ++row)
+			{
+				if (!segment_kind(kind[row]))
+					continue;
+
+				auto region = coverage::CounterMappingRegion::makeRegion(coverage::Counter::getZero(), 0,
+					line[row], column[row], end_line[row], end_column[row]);
+				region.Kind = (coverage::CounterMappingRegion::RegionKind) kind[row];
+				regions.emplace_back(region, st.counts()[row]);
+			}
+		}
+
+		fc.segments = SegmentBuilder::segments_of(regions);
+		if (!fc.empty())
+			print_file_counters(w, st.string(e->string), fc);
+	}
+
+	return(w.flush() != 0);
+}
+
+/**
+	// Print the regions of the function &name with their total counts.
+
+	// The output is the function's `@name` line followed by `fileid:path` lines for
+	// each of its sections and `line column end-line end-column kind count` rows;
+	// the kind of expansions is `X` followed by the identifier of the expanded file.
+*/
+int
+store_function(FILE *fp, char *store, char *id, char *name)
+{
+	struct Store st;
+
+	if (store_open(&st, std::string(store) + "/" + id) != 0)
+		return(1);
+
+	Measure m(phase_output);
+	Writer w(fp);
+	const uint64_t *count = (const uint64_t *) st.at(st.columns->count);
+	const uint32_t *line = (const uint32_t *) st.at(st.columns->line);
+	const uint32_t *column = (const uint32_t *) st.at(st.columns->column);
+	const uint32_t *end_line = (const uint32_t *) st.at(st.columns->end_line);
+	const uint32_t *end_column = (const uint32_t *) st.at(st.columns->end_column);
+	const uint8_t *kind = (const uint8_t *) st.at(st.columns->kind);
+	bool found = false;
+
+	for (uint64_t i = 0; i < st.header->functions; ++i)
+	{
+		const auto &e = st.functions()[i];
+
+		if (st.string(e.string) != name)
+			continue;
+
+		found = true;
+		w.put('@').put(name).put('\n');
+
+		for (auto si : st.identifiers(e))
+		{
+			const auto &section = st.sections()[si];
+
+			w.number(section.file).put(':').put(st.string(section.file)).put('\n');
+
+			for (uint64_t row = section.start; row < section.start + section.rows; ++row)
+			{
+				int ksz;
+
+				w.number(line[row]).put(' ').number(column[row]).put(' ');
+				w.number(end_line[row]).put(' ').number(end_column[row]).put(' ');
+
+				if (kind[row] == coverage::CounterMappingRegion::ExpansionRegion)
+					w.put('X').number(count[row]);
+				else
+				{
+					const char *k = region_kind(kind[row], StringRef(), &ksz);
+					w.put(k, ksz);
+				}
+
+				w.put(' ').number(st.counts()[row]).put('\n');
+			}
+		}
+	}
+
+	if (!found)
+	{
+		fprintf(stderr, "function '%s' is not present in the store\n", name);
+		return(1);
+	}
+
+	return(w.flush() != 0);
+}
+
+/**
+	// Test coverage matrix.
+
+	// A matrix is a directory holding the region table and index of the images, as
+	// in a store, the newline separated names of the tests, `tests`, and the set of
+	// tests that hit each row of the region table, `bitsets`. The sets are roaring
+	// style: the test identifiers are divided into containers by their high sixteen
+	// bits, and each container is either a sorted array of the low bits or, when it
+	// has more than &array_limit members, a bitmap of 65536 bits.
+*/
+static const uint32_t array_limit = 4096;
+
+enum ContainerType {
+	container_array = 0,
+	container_bitmap,
+};
+
+/**
+	// The header is followed by the offsets of the rows' sets, relative to the
+	// end of the offsets, with a final offset marking the end of the data.
+*/
+struct BitsetsHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t order;
+	uint64_t rows;
+	uint64_t tests;
+};
+
+/**
+	// A container's members follow its header and are padded to eight bytes.
+*/
+struct ContainerHeader {
+	uint16_t key;
+	uint16_t type;
+	uint32_t cardinality;
+};
+
+/**
+	// Append the container of the tests with the high bits &key and the sorted low bits &low to &out.
+*/
+static void
+container_encode(std::string &out, uint16_t key, const std::vector<uint16_t> &low)
+{
+	static const char padding[8] = {0};
+	struct ContainerHeader h = {key, container_array, (uint32_t) low.size()};
+
+	if (h.cardinality > array_limit)
+	{
+		std::vector<uint64_t> words(1024, 0);
+
+		h.type = container_bitmap;
+		for (auto l : low)
+			words[l >> 6] |= (uint64_t) 1 << (l & 63);
+
+		out.append((const char *) &h, sizeof(h));
+		out.append((const char *) words.data(), words.size() * sizeof(uint64_t));
+	}
+	else
+	{
+		out.append((const char *) &h, sizeof(h));
+		out.append((const char *) low.data(), low.size() * sizeof(uint16_t));
+		out.append(padding, (8 - ((h.cardinality * 2) % 8)) % 8);
+	}
+}
+
+/**
+	// The set of a row under construction; the containers of the completed keys
+	// are encoded in &data, and &low holds the members of the current key.
+*/
+struct MatrixRow {
+	std::string data;
+	std::vector<uint16_t> low;
+	uint16_t key;
+
+	/**
+		// Add &test, which is greater than the members, encoding the
+		// current container when &test starts a new key.
+	*/
+	void
+	add(uint32_t test)
+	{
+		if (!low.empty() && (test >> 16) != key)
+			finish();
+
+		key = test >> 16;
+		low.push_back(test & 0xFFFF);
+	}
+
+	void
+	finish()
+	{
+		if (!low.empty())
+			container_encode(data, key, low);
+		std::vector<uint16_t>().swap(low);
+	}
+};
+
+/**
+	// Add the members of the compressed set between &p and &end to &tests.
+*/
+static void
+bitset_union(BitVector &tests, const char *p, const char *end)
+{
+	while (p + sizeof(struct ContainerHeader) <= end)
+	{
+		const struct ContainerHeader *h = (const struct ContainerHeader *) p;
+		uint32_t base = (uint32_t) h->key << 16;
+
+		p += sizeof(*h);
+
+		if (h->type == container_bitmap)
+		{
+			const uint64_t *words = (const uint64_t *) p;
+
+			for (uint32_t w = 0; w < 1024; ++w)
+			{
+				for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1)
+				{
+					uint32_t t = base + w * 64 + countTrailingZeros(bits);
+					if (t < tests.size())
+						tests.set(t);
+				}
+			}
+
+			p += 1024 * sizeof(uint64_t);
+		}
+		else
+		{
+			const uint16_t *low = (const uint16_t *) p;
+
+			for (uint32_t k = 0; k < h->cardinality; ++k)
+			{
+				if (base + low[k] < tests.size())
+					tests.set(base + low[k]);
+			}
+
+			p += alignTo(h->cardinality * sizeof(uint16_t), 8);
+		}
+	}
+}
+
+/**
+	// Call &work with the indexes below &n on the workers selected by -j.
+*/
+template <typename Work>
+static void
+parallel_each(size_t n, Work work)
+{
+	unsigned jobs = options.jobs ? options.jobs : std::thread::hardware_concurrency();
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+
+	auto run = [&]() {
+		for (size_t i = next++; i < n; i = next++)
+			work(i);
+	};
+
+	if (jobs <= 1 || n <= 1)
+	{
+		run();
+		return;
+	}
+
+	for (unsigned i = 0; i < std::min((size_t) jobs, n); ++i)
+		workers.emplace_back(run);
+	for (auto &t : workers)
+		t.join();
+}
+
+/**
+	// The mapping of a function retained for evaluating the test profiles;
+	// &row is the region table row of its first region.
+*/
+struct MatrixFunction {
+	std::string name;
+	uint64_t hash;
+	std::vector<coverage::CounterExpression> expressions;
+	std::vector<coverage::CounterMappingRegion> regions;
+	uint32_t row;
+};
+
+/**
+	// Build the test matrix of the profiles in the directory &profiles for the &images.
+
+	// The tests are named by the profiles' filenames and are identified by their
+	// position in the sorted directory. The profiles are evaluated in parallel in
+	// blocks, and the rows' containers are compressed as soon as the tests pass
+	// their keys, so only the current container of a row is held uncompressed.
+	// The number of tests is written to &fp.
+*/
+int
+matrix_build(FILE *fp, char *path, char *arch, int nimages, char **images, char *profiles)
+{
+	std::set<std::pair<std::string, uint64_t>> seen;
+	std::vector<struct MatrixFunction> functions;
+	std::vector<std::string> tests;
+	struct Columns columns;
+	std::string dir(path), names;
+	int r;
+
+	if (!sys::fs::is_directory(profiles))
+	{
+		fprintf(stderr, "%s: the test profiles must be a directory\n", profiles);
+		return(1);
+	}
+
+	if (profile_paths(profiles, tests) != 0)
+		return(1);
+
+	if (mkdir(path, 0777) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return(1);
+	}
+
+	r = read_records(arch, nimages, images,
+		[&](int, const coverage::CoverageMappingRecord &record) {
+			SmallBitVector selected(record.Filenames.size(), true);
+			struct MatrixFunction f;
+
+			if (!seen.emplace((std::string) record.FunctionName, record.FunctionHash).second)
+				return;
+
+			f.name = record.FunctionName.str();
+			f.hash = record.FunctionHash;
+			f.expressions.assign(record.Expressions.begin(), record.Expressions.end());
+			f.regions.assign(record.MappingRegions.begin(), record.MappingRegions.end());
+			f.row = columns.count.size();
+			functions.push_back(std::move(f));
+
+			columns_function_regions(&columns, record.FunctionName, record.Filenames, record.MappingRegions, selected);
+		});
+	if (r != 0)
+		return(1);
+
+	size_t rows = columns.count.size();
+	std::vector<struct MatrixRow> members(rows);
+	std::atomic<int> failed(0);
+	unsigned jobs = options.jobs ? options.jobs : std::thread::hardware_concurrency();
+	size_t block = std::max(1u, jobs) * 4;
+
+	for (size_t first = 0; first < tests.size(); first += block)
+	{
+		size_t n = std::min(block, tests.size() - first);
+		std::vector<std::vector<uint32_t>> hits(n);
+
+		parallel_each(n, [&](size_t i) {
+			std::vector<uint64_t> counts;
+			coverage::CoverageMappingRecord record;
+			auto profile = load_profile((char *) tests[first + i].c_str());
+
+			if (!profile)
+			{
+				failed = 1;
+				return;
+			}
+
+			for (const auto &f : functions)
+			{
+				record.FunctionName = f.name;
+				record.FunctionHash = f.hash;
+
+				if (!profile_counts(*profile, record, counts) || counts.empty())
+					continue;
+
+				coverage::CounterMappingContext ctx(f.expressions, counts);
+				for (size_t ri = 0; ri < f.regions.size(); ++ri)
+				{
+					if (region_count(ctx, f.regions[ri]) > 0)
+						hits[i].push_back(f.row + ri);
+				}
+			}
+		});
+
+		if (failed)
+			return(1);
+
+		/* Tests are added in order, so the members remain sorted. */
+		for (size_t i = 0; i < n; ++i)
+		{
+			for (auto row : hits[i])
+				members[row].add(first + i);
+		}
+	}
+
+	parallel_each(rows, [&](size_t row) {
+		members[row].finish();
+	});
+
+	std::vector<uint64_t> offsets(rows + 1, 0);
+	for (size_t row = 0; row < rows; ++row)
+		offsets[row + 1] = offsets[row] + members[row].data.size();
+
+	struct BitsetsHeader h;
+	std::string bitsets;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "ipqrbs", 7);
+	h.version = 1;
+	h.order = 0x01020304;
+	h.rows = rows;
+	h.tests = tests.size();
+
+	bitsets.append((const char *) &h, sizeof(h));
+	bitsets.reserve(sizeof(h) + offsets.size() * sizeof(uint64_t) + offsets[rows]);
+	bitsets.append((const char *) offsets.data(), offsets.size() * sizeof(uint64_t));
+	for (auto &m : members)
+	{
+		bitsets.append(m.data);
+		std::string().swap(m.data);
+	}
+
+	for (const auto &t : tests)
+	{
+		names.append(sys::path::filename(t).str());
+		names.push_back('\n');
+	}
+
+	if (store_replace(dir + "/tests", names.data(), names.size()) != 0)
+		return(1);
+	if (store_replace(dir + "/bitsets", bitsets.data(), bitsets.size()) != 0)
+		return(1);
+	if (store_create(dir, &columns, false) != 0)
+		return(1);
+
+	fprintf(fp, "%zu\n", tests.size());
+	return(0);
+}
+
+/**
+	// Print the names of the tests that hit any of the lines identified by &specs,
+	// `path:line`. A line is hit when any of the innermost code regions on it were
+	// executed: every region containing the line that encloses no other such region,
+	// including the identical regions of instantiations and the sibling regions.
+*/
+int
+matrix_covering(FILE *fp, char *path, int nspecs, char **specs)
+{
+	struct Store st;
+	std::string dir(path);
+	SmallVector<StringRef, 0> names;
+	const struct BitsetsHeader *h;
+
+	if (store_open(&st, dir, false) != 0)
+		return(1);
+
+	auto tbuf = MemoryBuffer::getFile(dir + "/tests");
+	auto bbuf = MemoryBuffer::getFile(dir + "/bitsets");
+	if (!tbuf || !bbuf)
+	{
+		fprintf(stderr, "%s: missing tests or bitsets\n", path);
+		return(1);
+	}
+
+	SplitString(tbuf.get()->getBuffer(), names, "\n");
+	h = (const struct BitsetsHeader *) bbuf.get()->getBufferStart();
+
+	if (bbuf.get()->getBufferSize() < sizeof(*h)
+		|| memcmp(h->magic, "ipqrbs", 7) != 0
+		|| h->order != 0x01020304
+		|| h->rows != st.columns->rows
+		|| h->tests != names.size())
+	{
+		fprintf(stderr, "%s: invalid or incompatible test matrix\n", path);
+		return(1);
+	}
+
+	const uint64_t *offsets = (const uint64_t *) (h + 1);
+	const char *data = (const char *) (offsets + h->rows + 1);
+	const uint32_t *line = (const uint32_t *) st.at(st.columns->line);
+	const uint32_t *column = (const uint32_t *) st.at(st.columns->column);
+	const uint32_t *end_line = (const uint32_t *) st.at(st.columns->end_line);
+	const uint32_t *end_column = (const uint32_t *) st.at(st.columns->end_column);
+	const uint8_t *kind = (const uint8_t *) st.at(st.columns->kind);
+	BitVector covered(names.size());
+
+	for (int i = 0; i < nspecs; ++i)
+	{
+		StringRef spec(specs[i]);
+		size_t colon = spec.rfind(':');
+		const struct IndexEntry *file = NULL;
+		std::vector<uint64_t> candidates;
+		unsigned long ln;
+
+		if (colon == StringRef::npos || spec.substr(colon + 1).getAsInteger(10, ln))
+		{
+			fprintf(stderr, "invalid line specification '%s'\n", specs[i]);
+			return(1);
+		}
+
+		for (uint64_t fi = 0; fi < st.header->files; ++fi)
+		{
+			if (st.string(st.files()[fi].string) == spec.substr(0, colon))
+				file = &st.files()[fi];
+		}
+
+		if (file == NULL)
+		{
+			fprintf(stderr, "%.*s: not present in the test matrix\n", (int) colon, specs[i]);
+			continue;
+		}
+
+		for (auto si : st.identifiers(*file))
+		{
+			const auto &section = st.sections()[si];
+
+			for (uint64_t row = section.start; row < section.start + section.rows; ++row)
+			{
+				if (kind[row] == coverage::CounterMappingRegion::CodeRegion
+					&& line[row] <= ln && ln <= end_line[row])
+					candidates.push_back(row);
+			}
+		}
+
+		if (candidates.empty())
+			continue;
+
+		/* Whether the region of row &a strictly encloses that of row &b. */
+		auto encloses = [&](uint64_t a, uint64_t b) {
+			auto as = std::make_pair(line[a], column[a]), ae = std::make_pair(end_line[a], end_column[a]);
+			auto bs = std::make_pair(line[b], column[b]), be = std::make_pair(end_line[b], end_column[b]);
+			return(as <= bs && be <= ae && (as != bs || ae != be));
+		};
+
+		/* The innermost regions are those enclosing no other candidate; siblings are all included. */
+		for (auto row : candidates)
+		{
+			if (std::none_of(candidates.begin(), candidates.end(),
+				[&](uint64_t other) { return(encloses(row, other)); }))
+				bitset_union(covered, data + offsets[row], data + offsets[row + 1]);
+		}
+	}
+
+	Writer w(fp);
+	for (auto t : covered.set_bits())
+		w.put(names[t]).put('\n');
+
+	return(w.flush() != 0);
+}
+
+/**
+	// The mapping of a function retained by &watch_profiles; &row is the
+	// position of the function's first region in the counts of a snapshot.
+*/
+struct WatchFunction {
+	std::string name;
+	uint64_t hash;
+	std::vector<std::string> filenames;
+	SmallBitVector selected;
+	std::vector<coverage::CounterExpression> expressions;
+	std::vector<coverage::CounterMappingRegion> regions;
+	size_t row;
+};
+
+/**
+	// Modification time and size of a profile in the watched directory.
+*/
+struct WatchState {
+	sys::TimePoint<> mtime;
+	uint64_t size;
+
+	bool
+	operator==(const struct WatchState &s) const
+	{
+		return(mtime == s.mtime && size == s.size);
+	}
+
+	bool
+	operator!=(const struct WatchState &s) const
+	{
+		return(!(*this == s));
+	}
+};
+
+static volatile sig_atomic_t watch_stopped = 0;
+
+static void
+watch_stop(int)
+{
+	watch_stopped = 1;
+}
+
+/**
+	// Identify the profiles of &dir that are ready to be ingested, in modification order.
+	// A profile is ready when its modification time and size are unchanged since the
+	// previous scan, so dumps still being written are deferred, and differ from the
+	// version that was last ingested. Hidden files are ignored.
+*/
+static int
+watch_scan(char *dir, std::map<std::string, struct WatchState> &observed,
+	const std::map<std::string, struct WatchState> &ingested, std::vector<std::string> &ready)
+{
+	std::map<std::string, struct WatchState> current;
+	std::error_code EC;
+
+	for (sys::fs::directory_iterator i(dir, EC), end; i != end && !EC; i.increment(EC))
+	{
+		sys::fs::file_status st;
+
+		if (sys::path::filename(i->path()).startswith("."))
+			continue;
+		if (sys::fs::status(i->path(), st) || !sys::fs::is_regular_file(st))
+			continue;
+
+		struct WatchState s = {st.getLastModificationTime(), st.getSize()};
+		auto prior = observed.find(i->path());
+		auto last = ingested.find(i->path());
+
+		if (prior != observed.end() && prior->second == s && (last == ingested.end() || last->second != s))
+			ready.push_back(i->path());
+
+		current.emplace(i->path(), s);
+	}
+
+	if (EC)
+	{
+		fprintf(stderr, "%s: %s\n", dir, EC.message().c_str());
+		return(1);
+	}
+
+	std::sort(ready.begin(), ready.end(), [&](const std::string &a, const std::string &b) {
+		return(std::make_pair(current[a].mtime, a) < std::make_pair(current[b].mtime, b));
+	});
+
+	observed.swap(current);
+	return(0);
+}
+
+/**
+	// Evaluate the counts of the &functions from the profile at &path and print the
+	// regions whose counts differ from &last, the counts of the previous snapshot of
+	// the same path.
+
+	// Dumps are successive snapshots of cumulative counters, so when any count
+	// decreased, the instrumented process is taken to have been restarted and
+	// the delta of every region is its count.
+*/
+static int
+watch_snapshot(Writer &w, const std::vector<struct WatchFunction> &functions,
+	std::vector<uint64_t> &last, const std::string &path, const struct WatchState &st)
+{
+	std::vector<uint64_t> counts, current(last);
+	std::vector<bool> matched(functions.size(), false);
+	coverage::CoverageMappingRecord record;
+	unsigned long mismatched = 0;
+	bool reset = false;
+	char timestamp[32];
+
+	auto profile = load_profile((char *) path.c_str());
+	if (!profile)
+		return(1);
+
+	for (size_t fi = 0; fi < functions.size(); ++fi)
+	{
+		const auto &f = functions[fi];
+
+		record.FunctionName = f.name;
+		record.FunctionHash = f.hash;
+
+		if (!profile_counts(*profile, record, counts))
+		{
+			++mismatched;
+			continue;
+		}
+
+		coverage::CounterMappingContext ctx(f.expressions, counts);
+
+		matched[fi] = true;
+		for (size_t ri = 0; ri < f.regions.size(); ++ri)
+		{
+			uint64_t count = region_count(ctx, f.regions[ri]);
+
+			reset |= count < last[f.row + ri];
+			current[f.row + ri] = count;
+		}
+	}
+
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(st.mtime.time_since_epoch()).count();
+	int tsz = snprintf(timestamp, sizeof(timestamp), "%lld.%06lld",
+		(long long) (us / 1000000), (long long) (us % 1000000));
+	w.put("t ").put(timestamp, tsz).put(' ').put(path).put('\n');
+
+	for (size_t fi = 0; fi < functions.size(); ++fi)
+	{
+		const auto &f = functions[fi];
+		bool opened = false;
+		int lastfile = -1;
+
+		if (!matched[fi])
+			continue;
+
+		for (size_t ri = 0; ri < f.regions.size(); ++ri)
+		{
+			const auto &region = f.regions[ri];
+			uint64_t count = current[f.row + ri], prior = last[f.row + ri];
+			uint64_t delta = reset ? count : count - prior;
+
+			if ((count == prior && delta == 0) || !f.selected[region.FileID])
+				continue;
+
+			if (!opened)
+			{
+				w.put('@').put(function_name(f.name)).put(' ').number(f.hash).put('\n');
+				opened = true;
+			}
+
+			if ((int) region.FileID != lastfile)
+			{
+				lastfile = region.FileID;
+				w.number(region.FileID).put(':').put(f.filenames[region.FileID]).put('\n');
+			}
+
+			w.number(ri).put(' ');
+			w.number(region.LineStart).put(' ').number(region.ColumnStart).put(' ');
+			w.number(region.LineEnd).put(' ').number(region.ColumnEnd).put(' ');
+			w.number(count).put(' ').number(delta).put('\n');
+		}
+	}
+
+	last.swap(current);
+
+	if (mismatched > 0)
+		fprintf(stderr, "%s: %lu functions skipped due to profile hash mismatches\n", path.c_str(), mismatched);
+
+	return(0);
+}
+
+/**
+	// Ingest the profiles written to the directory &dir as they appear, printing the
+	// counter deltas of the regions of the &images for each one until interrupted.
+
+	// The function records are read once and retained, so each dump only costs the
+	// reading of the profile. Every snapshot is introduced by a `t seconds path` line
+	// carrying the modification time of the dump, and is followed by the changed
+	// regions in the form of the diff query: `@name hash`, `fileid:path`, and
+	// `index line column end-line end-column count delta` lines. The deltas are
+	// relative to the previous snapshot of the same path, so the dumps of
+	// concurrent processes are tracked apart. The directory is scanned every
+	// &interval milliseconds; dumps present at startup are ingested first, and
+	// the deltas of a path's first snapshot are its counts.
+*/
+int
+watch_profiles(FILE *fp, unsigned long interval, char *arch, int nimages, char **images, char *dir)
+{
+	std::set<std::pair<std::string, uint64_t>> seen;
+	std::vector<struct WatchFunction> functions;
+	std::map<std::string, struct WatchState> observed, ingested;
+	std::map<std::string, std::vector<uint64_t>> last;
+	size_t rows = 0;
+	struct sigaction sa;
+	Writer w(fp);
+	int r;
+
+	if (!sys::fs::is_directory(dir))
+	{
+		fprintf(stderr, "%s: the watched profiles must be a directory\n", dir);
+		return(1);
+	}
+
+	r = read_records(arch, nimages, images,
+		[&](int, const coverage::CoverageMappingRecord &record) {
+			struct WatchFunction f;
+
+			if (!select_function(record.FunctionName))
+				return;
+
+			f.selected = select_record_files(record.Filenames);
+			if (f.selected.none())
+				return;
+
+			if (!seen.emplace((std::string) record.FunctionName, record.FunctionHash).second)
+				return;
+
+			f.name = record.FunctionName.str();
+			f.hash = record.FunctionHash;
+			for (auto fn : record.Filenames)
+				f.filenames.push_back(fn.str());
+			f.expressions.assign(record.Expressions.begin(), record.Expressions.end());
+			f.regions.assign(record.MappingRegions.begin(), record.MappingRegions.end());
+			f.row = rows;
+			rows += f.regions.size();
+			functions.push_back(std::move(f));
+		});
+	if (r != 0)
+		return(1);
+
+	/* Interruption ends the watch after the current snapshot. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = watch_stop;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!watch_stopped)
+	{
+		std::vector<std::string> ready;
+		struct timespec delay = {(time_t) (interval / 1000), (long) (interval % 1000) * 1000000};
+
+		if (watch_scan(dir, observed, ingested, ready) != 0)
+			return(1);
+
+		for (const auto &path : ready)
+		{
+			const auto &st = observed[path];
+			auto &counts = last[path];
+
+			/* Failed dumps are not retried until they are rewritten. */
+			ingested[path] = st;
+			counts.resize(rows, 0);
+			if (watch_snapshot(w, functions, counts, path, st) != 0)
+				continue;
+
+			if (w.flush() != 0 || fflush(fp) != 0)
+				return(1);
+		}
+
+		nanosleep(&delay, NULL);
+	}
+
+	return(w.flush() != 0);
+}
+#else
+int
+store_add(FILE *fp, char *store, char *arch, int nimages, char **images, char *datafile)
+{
+	fprintf(stderr, "coverage stores require LLVM 10 or later\n");
+	return(1);
+}
+
+int
+store_counters(FILE *fp, char *store, char *id, char *file)
+{
+	fprintf(stderr, "coverage stores require LLVM 10 or later\n");
+	return(1);
+}
+
+int
+store_function(FILE *fp, char *store, char *id, char *name)
+{
+	fprintf(stderr, "coverage stores require LLVM 10 or later\n");
+	return(1);
+}
+
+int
+matrix_build(FILE *fp, char *path, char *arch, int nimages, char **images, char *profiles)
+{
+	fprintf(stderr, "test matrices require LLVM 10 or later\n");
+	return(1);
+}
+
+int
+matrix_covering(FILE *fp, char *path, int nspecs, char **specs)
+{
+	fprintf(stderr, "test matrices require LLVM 10 or later\n");
+	return(1);
+}
+
+int
+watch_profiles(FILE *fp, unsigned long interval, char *arch, int nimages, char **images, char *dir)
+{
+	fprintf(stderr, "watch requires LLVM 10 or later\n");
+	return(1);
+}
+#endif
+
+/**
+	// A mapping record retained by the query server; &name is the record's
+	// name, which keeps the file prefix of local functions, and &image is the
+	// index of the image the record was first read from.
+*/
+struct ServerFunction {
+	std::string name;
+	int image;
+	std::vector<std::string> filenames;
+	std::vector<coverage::CounterMappingRegion> regions;
+};
+
+/**
+	// Resident coverage mapping used by the query server.
+*/
+struct Server {
+	std::unique_ptr<coverage::CoverageMapping> coverage;
+
+	/**
+		// Cached results of getCoverageForFile.
+	*/
+	std::map<std::string, coverage::CoverageData> files;
+
+	/**
+		// The mapping records answering regions, in the order of print_regions.
+	*/
+	std::vector<struct ServerFunction> functions;
+};
+
+/**
+	// Load the mapping of the server and retain the mapping records of the functions.
+*/
+static int
+server_load(struct Server *srv, char *arch, int nimages, char **images, char *datafile)
+{
+	std::set<std::pair<std::string, uint64_t>> seen;
+
+	srv->coverage = load_mapping(arch, nimages, images, datafile);
+	if (!srv->coverage)
+		return(1);
+
+	return(read_records(arch, nimages, images,
+		[&](int i, const coverage::CoverageMappingRecord &record) {
+			struct ServerFunction f;
+
+			if (!seen.emplace((std::string) record.FunctionName, record.FunctionHash).second)
+				return;
+
+			f.name = record.FunctionName.str();
+			f.image = i;
+			for (auto fn : record.Filenames)
+				f.filenames.push_back(fn.str());
+			f.regions.assign(record.MappingRegions.begin(), record.MappingRegions.end());
+			srv->functions.push_back(std::move(f));
+		}));
+}
+
+/**
+	// Retrieve the coverage of &file from the server's cache,
+	// computing it on the first request.
+*/
+static const coverage::CoverageData &
+server_file_coverage(struct Server *srv, StringRef file)
+{
+	auto i = srv->files.find((std::string) file);
+
+	if (i == srv->files.end())
+	{
+		auto data = srv->coverage->getCoverageForFile(file);
+		i = srv->files.emplace((std::string) file, std::move(data)).first;
+	}
+
+	return(i->second);
+}
+
+/**
+	// Answer a single query line. Responses are terminated with an empty line.
+*/
+static int
+server_query(FILE *fp, struct Server *srv, char *line)
+{
+	char *arg = strchr(line, ' ');
+	StringRef subject;
+	Writer w(fp);
+
+	if (arg != NULL)
+	{
+		*arg++ = 0;
+		subject = StringRef(arg);
+	}
+
+	if (strcmp(line, "sources") == 0)
+	{
+		for (auto &file : selected_files(*srv->coverage))
+			w.put(file).put('\n');
+	}
+	else if (strcmp(line, "counters") == 0)
+	{
+		if (arg != NULL)
+		{
+			const auto &data = server_file_coverage(srv, subject);
+			if (!data.empty())
+				print_file_counters(w, subject, data);
+		}
+		else
+		{
+			for (auto &file : selected_files(*srv->coverage))
+			{
+				const auto &data = server_file_coverage(srv, file);
+				if (!data.empty())
+					print_file_counters(w, file, data);
+			}
+		}
+	}
+	else if (strcmp(line, "regions") == 0)
+	{
+		int image = -1, last = -1;
+
+		/* The regions of the mapping records, named and filtered as print_regions does. */
+		for (const auto &f : srv->functions)
+		{
+			if (f.image != image)
+			{
+				image = f.image;
+				last = -1;
+			}
+
+			if (!select_function(f.name))
+				continue;
+
+			StringRef fname = function_name(f.name);
+			if (arg != NULL && subject != fname && subject != f.name)
+				continue;
+
+			std::vector<StringRef> filenames(f.filenames.begin(), f.filenames.end());
+			auto selected = select_record_files(filenames);
+			if (selected.none())
+				continue;
+
+			print_function_regions(w, fname, filenames, f.regions, &last, selected);
+		}
+	}
+	else if (strcmp(line, "quit") == 0)
+		return(-1);
+	else
+		fprintf(fp, "!unknown query '%s'\n", line);
+
+	w.put('\n').flush();
+	fflush(fp);
+	return(0);
+}
+
+/**
+	// Read line delimited queries from &in and write the responses to &out
+	// until end of file or a quit query is received.
+*/
+static int
+serve(FILE *in, FILE *out, struct Server *srv)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int r = 0;
+
+	while ((len = getline(&line, &size, in)) != -1)
+	{
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = 0;
+
+		if (len == 0)
+			continue;
+
+		if ((r = server_query(out, srv, line)) != 0)
+			break;
+	}
+
+	free(line);
+	return(r);
+}
+
+/**
+	// Load the mapping once and answer queries from standard input.
+*/
+int
+serve_stdio(char *arch, int nimages, char **images, char *datafile)
+{
+	struct Server srv;
+
+	if (server_load(&srv, arch, nimages, images, datafile) != 0)
+		return(1);
+
+	serve(stdin, stdout, &srv);
+	return(0);
+}
+
+static volatile sig_atomic_t listen_stopped = 0;
+
+static void
+listen_stop(int)
+{
+	listen_stopped = 1;
+}
+
+/**
+	// Remove the socket file at &path left by a server that is no longer running.
+	// Fails when a server is accepting connections on it.
+*/
+static int
+socket_clear(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, r;
+
+	if (lstat(addr->sun_path, &st) != 0 || !S_ISSOCK(st.st_mode))
+		return(0);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return(0);
+
+	r = connect(fd, (const struct sockaddr *) addr, sizeof(*addr));
+	close(fd);
+
+	if (r == 0)
+	{
+		fprintf(stderr, "%s: a server is already listening\n", addr->sun_path);
+		return(1);
+	}
+
+	unlink(addr->sun_path);
+	return(0);
+}
+
+/**
+	// Load the mapping once and answer queries from the connections
+	// accepted on the Unix socket bound to &path.
+	// Connections are served sequentially; a client's quit only closes its
+	// connection, and the server runs until it is interrupted.
+*/
+int
+serve_socket(char *path, char *arch, int nimages, char **images, char *datafile)
+{
+	struct Server srv;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	int sfd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "socket path is too long\n");
+		return(1);
+	}
+
+	if (server_load(&srv, arch, nimages, images, datafile) != 0)
+		return(1);
+
+	/* Disconnecting clients should not terminate the server. */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Interruption ends the accept loop so that the socket is removed. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = listen_stop;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (socket_clear(&addr) != 0)
+		return(1);
+
+	sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sfd == -1 || bind(sfd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(sfd, 8) == -1)
+	{
+		perror("socket");
+		return(1);
+	}
+
+	while (!listen_stopped)
+	{
+		FILE *in, *out;
+		int cfd = accept(sfd, NULL, NULL), ofd;
+
+		if (cfd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			perror("accept");
+			break;
+		}
+
+		ofd = dup(cfd);
+		in = fdopen(cfd, "r");
+		out = ofd == -1 ? NULL : fdopen(ofd, "w");
+
+		if (in == NULL || out == NULL)
+		{
+			perror("fdopen");
+
+			if (in != NULL)
+				fclose(in);
+			else
+				close(cfd);
+
+			if (out != NULL)
+				fclose(out);
+			else if (ofd != -1)
+				close(ofd);
+
+			continue;
+		}
+
+		serve(in, out, &srv);
+		fclose(in);
+		fclose(out);
+	}
+
+	close(sfd);
+	unlink(path);
+	return(0);
+}
+
+/*
+	// ipqmodule.cc includes this file to provide the queries to Python.
+*/
+#ifndef IPQ_MODULE
+/**
+	// Dispatch the query named by argv[1] writing its primary output to &out.
+*/
+static int
+query(int argc, char *argv[], FILE *out)
+{
+	unsigned long n;
+
+	if (strcmp(argv[1], "regions") == 0)
+	{
+		if (argc < 4)
+			fprintf(stderr, "ERROR: regions requires at least two arguments.\n");
+		else
+			return(print_regions(out, argv[2], argc - 3, argv + 3));
+	}
+	else if (strcmp(argv[1], "sources") == 0)
+	{
+		if (argc < 4)
+			fprintf(stderr, "ERROR: sources requires at least two arguments.\n");
+		else if (options.ceiling > 0)
+			return(stream_sources(out, argv[2], argc - 3, argv + 3));
+		else
+			return(print_sources(out, argv[2], argc - 3, argv + 3));
+	}
+	else
+	{
+		if (strcmp(argv[1], "counters") == 0)
+		{
+			if (argc < 5)
+				fprintf(stderr, "ERROR: counters requires at least three arguments.\n");
+			else if (options.ceiling > 0)
+				return(stream_counters(out, argv[2], argc - 4, argv + 3, argv[argc-1]));
+			else
+				return(print_counters(out, argv[2], argc - 4, argv + 3, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "lines") == 0)
+		{
+			if (argc < 5)
+				fprintf(stderr, "ERROR: lines requires at least three arguments.\n");
+			else
+				return(print_lines(out, argv[2], argc - 4, argv + 3, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "uncovered") == 0)
+		{
+			if (argc < 5)
+				fprintf(stderr, "ERROR: uncovered requires at least three arguments.\n");
+			else
+				return(print_uncovered(out, argv[2], argc - 4, argv + 3, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "export") == 0)
+		{
+			if (argc < 5)
+				fprintf(stderr, "ERROR: export requires at least three arguments.\n");
+			else
+				return(print_export(out, argv[2], argc - 4, argv + 3, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "changed") == 0)
+		{
+			if (argc < 6)
+				fprintf(stderr, "ERROR: changed requires at least four arguments.\n");
+			else
+				return(print_changed(out, argv[2], argv[3], argc - 5, argv + 4, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "serve") == 0)
+		{
+			if (argc < 5)
+				fprintf(stderr, "ERROR: serve requires at least three arguments.\n");
+			else
+				return(serve_stdio(argv[2], argc - 4, argv + 3, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "diff") == 0)
+		{
+			if (argc < 6)
+				fprintf(stderr, "ERROR: diff requires at least four arguments.\n");
+			else
+				return(print_diff(out, argv[2], argc - 5, argv + 3, argv[argc-2], argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "all") == 0)
+		{
+			if (argc < 8)
+				fprintf(stderr, "ERROR: all requires at least six arguments.\n");
+			else
+				return(print_all(argv[2], argv[3], argv[4], argv[5], argc - 7, argv + 6, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "listen") == 0)
+		{
+			if (argc < 6)
+				fprintf(stderr, "ERROR: listen requires at least four arguments.\n");
+			else
+				return(serve_socket(argv[2], argv[3], argc - 5, argv + 4, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "hot") == 0)
+		{
+			if (argc < 6)
+				fprintf(stderr, "ERROR: hot requires at least four arguments.\n");
+			else if (positive("the hot limit", argv[2], &n) == 0)
+				return(print_hot(out, n, argv[3], argc - 5, argv + 4, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "store") == 0)
+		{
+			if (argc < 6)
+				fprintf(stderr, "ERROR: store requires at least four arguments.\n");
+			else
+				return(store_add(out, argv[2], argv[3], argc - 5, argv + 4, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "stored") == 0)
+		{
+			if (argc < 4 || argc > 5)
+				fprintf(stderr, "ERROR: stored requires two or three arguments.\n");
+			else
+				return(store_counters(out, argv[2], argv[3], argc == 5 ? argv[4] : NULL));
+		}
+		else if (strcmp(argv[1], "matrix") == 0)
+		{
+			if (argc < 6)
+				fprintf(stderr, "ERROR: matrix requires at least four arguments.\n");
+			else
+				return(matrix_build(out, argv[2], argv[3], argc - 5, argv + 4, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "covering") == 0)
+		{
+			if (argc < 4)
+				fprintf(stderr, "ERROR: covering requires at least two arguments.\n");
+			else
+				return(matrix_covering(out, argv[2], argc - 3, argv + 3));
+		}
+		else if (strcmp(argv[1], "watch") == 0)
+		{
+			if (argc < 6)
+				fprintf(stderr, "ERROR: watch requires at least four arguments.\n");
+			else if (positive("the watch interval", argv[2], &n) == 0)
+				return(watch_profiles(out, n, argv[3], argc - 5, argv + 4, argv[argc-1]));
+		}
+		else if (strcmp(argv[1], "stored-function") == 0)
+		{
+			if (argc != 5)
+				fprintf(stderr, "ERROR: stored-function requires three arguments.\n");
+			else
+				return(store_function(out, argv[2], argv[3], argv[4]));
+		}
+		else
+			fprintf(stderr, "unknown query '%s'\n", argv[1]);
+	}
+
+	return(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt, r;
+	unsigned long n;
+
+	while ((opt = getopt(argc, argv, "ABDF:j:i:x:I:X:M:s:z:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'F':
+				if (strcmp(optarg, "text") == 0)
+					options.format = format_text;
+				else if (strcmp(optarg, "binary") == 0)
+					options.format = format_binary;
+				else if (strcmp(optarg, "indexed") == 0)
+					options.format = format_indexed;
+				else
+				{
+					fprintf(stderr, "unknown format '%s'\n", optarg);
+					return(248);
+				}
+			break;
+
+			case 'i':
+				options.paths.include.push_back(optarg);
+			break;
+			case 'x':
+				options.paths.exclude.push_back(optarg);
+			break;
+			case 'I':
+				options.functions.include.push_back(optarg);
+			break;
+			case 'X':
+				options.functions.exclude.push_back(optarg);
+			break;
+
+			case 's':
+				stats.path = optarg;
+			break;
+
+			case 'A':
+				options.all = true;
+			break;
+
+			case 'B':
+				options.branches = true;
+			break;
+
+			case 'D':
+				#if (LLVM_VERSION_MAJOR >= 9)
+					options.demangle = true;
+				#else
+					fprintf(stderr, "demangling requires LLVM 9 or later\n");
+					return(248);
+				#endif
+			break;
+
+			case 'j':
+				if (positive("the number of jobs", optarg, &n) != 0)
+					return(248);
+				options.jobs = (unsigned) std::min(n, (unsigned long) UINT_MAX);
+			break;
+
+			case 'z':
+				if (compression_select(optarg) != 0)
+					return(248);
+			break;
+
+			case 'M':
+				if (positive("the memory ceiling in megabytes", optarg, &n) != 0)
+					return(248);
+				options.ceiling = (size_t) n << 20;
+			break;
+
+			default:
+				return(248);
+		}
+	}
+
+	/* Binary counters have no branch columns; the regions' kind column always identifies them. */
+	if (options.branches && options.format == format_binary)
+	{
+		fprintf(stderr, "-B is not available in the binary format\n");
+		return(248);
+	}
+
+	/* Leave argv[1] as the query. */
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "ipq [-ABD] [-F text|binary|indexed] [-j jobs] [-i|-x path-pattern] [-I|-X function-pattern] [-M megabytes] [-s statistics-path] [-z zlib|zstd[:level]] regions|sources|counters|lines|serve architecture image... [merged-profile-data]\n");
+		fprintf(stderr, "ipq listen socket-path architecture image... merged-profile-data\n");
+		fprintf(stderr, "ipq diff architecture image... baseline-profile-data candidate-profile-data\n");
+		fprintf(stderr, "ipq all sources-path regions-path counters-path architecture image... merged-profile-data\n");
+		fprintf(stderr, "ipq hot limit architecture image... profile-data\n");
+		fprintf(stderr, "ipq uncovered architecture image... profile-data\n");
+		fprintf(stderr, "ipq export architecture image... profile-data\n");
+		fprintf(stderr, "ipq changed unified-diff|changes-path architecture image... profile-data\n");
+		fprintf(stderr, "ipq store store-path architecture image... profile-data\n");
+		fprintf(stderr, "ipq stored store-path identifier [source-path]\n");
+		fprintf(stderr, "ipq stored-function store-path identifier function-name\n");
+		fprintf(stderr, "ipq matrix matrix-path architecture image... profile-directory\n");
+		fprintf(stderr, "ipq covering matrix-path source-path:line...\n");
+		fprintf(stderr, "ipq watch interval-milliseconds architecture image... profile-directory\n");
+		fprintf(stderr, "Merged profile data is only required by counters, lines, and the servers and must be the last argument.\n");
+		fprintf(stderr, "The binary format is a memory mappable column set written by regions and counters.\n");
+		fprintf(stderr, "The indexed format declares the filenames of regions once and refers to them by identifier.\n");
+		fprintf(stderr, "Profile data may be raw profiles or a directory of them; they are merged in memory.\n");
+		fprintf(stderr, "Patterns with glob characters are matched with fnmatch, others as prefixes.\n");
+		fprintf(stderr, "uncovered prints the extents of the code regions never executed; -A includes every region's count.\n");
+		fprintf(stderr, "export writes the files, segments, and summaries of llvm-cov export's JSON.\n");
+		fprintf(stderr, "-B includes branch coverage in the text regions and counters; it is rejected by -F binary.\n");
+		fprintf(stderr, "-D demangles the function names of regions; the file of a local function follows a tab.\n");
+		fprintf(stderr, "Statistics are written as JSON to the given path; - selects standard error.\n");
+		fprintf(stderr, "Their output_bytes counts the output before any -z compression.\n");
+		fprintf(stderr, "-z compresses the output in independently decompressible chunks; levels are 1-9 for zlib and 1-22 for zstd.\n");
+		fprintf(stderr, "-M streams sources and counters from the function records, spilling sorted runs to\n");
+		fprintf(stderr, "temporary files whenever the given number of megabytes is reached.\n");
+		fprintf(stderr, "store adds the counters of a profile to the store and prints the images' identifier;\n");
+		fprintf(stderr, "stored and stored-function answer counters and function regions from the accumulated total.\n");
+		fprintf(stderr, "matrix records the regions hit by each test profile of the directory, and covering\n");
+		fprintf(stderr, "prints the tests that hit the innermost regions of the given lines.\n");
+		fprintf(stderr, "watch prints the region counter deltas of each profile dumped into the directory until interrupted.\n");
+		return(248);
+	}
+
+	/* The servers and watch respond interactively and are never compressed. */
+	if (strcmp(argv[1], "serve") == 0 || strcmp(argv[1], "listen") == 0 || strcmp(argv[1], "watch") == 0)
+		options.compression = compression_none;
+
+	if (stats.path != NULL)
+	{
+		uint64_t start, end, cpu;
+		FILE *out = stats_output(compressed_output(stdout));
+
+		stats_clock(&start, &cpu);
+		r = query(argc, argv, out);
+		fclose(out);
+		stats_clock(&end, &cpu);
+
+		stats_write(argv[1], stats_seconds(end - start));
+		return(r);
+	}
+
+	if (options.compression != compression_none)
+	{
+		FILE *out = compressed_output(stdout);
+
+		r = query(argc, argv, out);
+		r |= fclose(out) != 0;
+		return(r);
+	}
+
+	return(query(argc, argv, stdout));
+}
+#endif
@@ -0,0 +1,430 @@
+/**
+	// CPython extension providing the sources, regions, and counters queries in-process.
+
+	// The query implementations are included from ipq.cc and the regions and
+	// counters are returned as the columns of the binary format: a tuple of
+	// strings and a set of &Array instances supporting the buffer protocol.
+*/
+#include <Python.h>
+
+#define IPQ_MODULE 1
+#if __has_include("ipq.h")
+	/* Instantiated factor; connect.py declares ipq.cc as the extension's ipq.h. */
+	#include "ipq.h"
+#else
+	#include "ipq.cc"
+#endif
+
+/*
+	// The queries share &options, &stats, and the path selection cache.
+*/
+static std::mutex module_lock;
+
+/**
+	// One dimensional array owning the storage of a column.
+*/
+struct Array {
+	PyObject_HEAD
+	void *storage;
+	void (*release)(void *);
+	char *data;
+	Py_ssize_t length;
+	Py_ssize_t itemsize;
+	const char *format;
+};
+
+template <typename T> struct ArrayFormat;
+template <> struct ArrayFormat<uint8_t> { static constexpr const char *code = "B"; };
+template <> struct ArrayFormat<uint32_t> { static constexpr const char *code = "I"; };
+template <> struct ArrayFormat<uint64_t> { static constexpr const char *code = "Q"; };
+
+static void
+array_dealloc(PyObject *self)
+{
+	struct Array *a = (struct Array *) self;
+
+	a->release(a->storage);
+	Py_TYPE(self)->tp_free(self);
+}
+
+static Py_ssize_t
+array_length(PyObject *self)
+{
+	return(((struct Array *) self)->length);
+}
+
+static int
+array_getbuffer(PyObject *self, Py_buffer *view, int flags)
+{
+	struct Array *a = (struct Array *) self;
+
+	if (PyBuffer_FillInfo(view, self, a->data, a->length * a->itemsize, 1, flags) != 0)
+		return(-1);
+
+	view->itemsize = a->itemsize;
+	if (flags & PyBUF_FORMAT)
+		view->format = (char *) a->format;
+	if (flags & PyBUF_ND)
+		view->shape = &a->length;
+
+	return(0);
+}
+
+static PySequenceMethods array_sequence = {
+	array_length,
+};
+
+static PyBufferProcs array_buffer = {
+	array_getbuffer,
+	NULL,
+};
+
+static PyTypeObject array_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"ipq.Array",
+};
+
+/**
+	// Move &v into a new &Array.
+*/
+template <typename T>
+static PyObject *
+array_create(std::vector<T> &v)
+{
+	struct Array *a;
+	auto storage = new std::vector<T>(std::move(v));
+
+	a = PyObject_New(struct Array, &array_type);
+	if (a == NULL)
+	{
+		delete storage;
+		return(NULL);
+	}
+
+	a->storage = storage;
+	a->release = [](void *p) { delete (std::vector<T> *) p; };
+	a->data = (char *) storage->data();
+	a->length = storage->size();
+	a->itemsize = sizeof(T);
+	a->format = ArrayFormat<T>::code;
+
+	return((PyObject *) a);
+}
+
+/**
+	// Query arguments converted from the Python call.
+*/
+struct Arguments {
+	char *arch;
+	char *datafile;
+	std::vector<char *> images;
+	PyObject *sequence;
+
+	Arguments() : arch(NULL), datafile(NULL), sequence(NULL) {}
+	~Arguments() { Py_XDECREF(sequence); }
+};
+
+/**
+	// Parse `(architecture, images[, profile])` into &a.
+*/
+static int
+arguments(PyObject *args, struct Arguments *a, bool profile)
+{
+	const char *arch, *datafile = NULL;
+	PyObject *images;
+	Py_ssize_t i, n;
+
+	if (profile)
+	{
+		if (!PyArg_ParseTuple(args, "sOs", &arch, &images, &datafile))
+			return(-1);
+	}
+	else
+	{
+		if (!PyArg_ParseTuple(args, "sO", &arch, &images))
+			return(-1);
+	}
+
+	a->sequence = PySequence_Fast(images, "images must be a sequence of paths");
+	if (a->sequence == NULL)
+		return(-1);
+
+	n = PySequence_Fast_GET_SIZE(a->sequence);
+	if (n == 0)
+	{
+		PyErr_SetString(PyExc_ValueError, "at least one image is required");
+		return(-1);
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		const char *path = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(a->sequence, i));
+		if (path == NULL)
+			return(-1);
+
+		a->images.push_back((char *) path);
+	}
+
+	a->arch = (char *) arch;
+	a->datafile = (char *) datafile;
+	return(0);
+}
+
+static PyObject *
+query_failed(const char *name)
+{
+	PyErr_Format(PyExc_RuntimeError, "%s query failed; diagnostics were written to standard error", name);
+	return(NULL);
+}
+
+static PyObject *
+string(StringRef str)
+{
+	return(PyUnicode_DecodeUTF8(str.data(), str.size(), "surrogateescape"));
+}
+
+/**
+	// Build the string table and column dictionary of &c.
+*/
+static PyObject *
+columns_object(struct Columns *c)
+{
+	PyObject *strings, *d;
+	PyObject *arrays[10];
+	size_t i, n = c->string_offsets.size();
+	std::vector<uint32_t> file, function;
+	std::vector<uint64_t> start, rows;
+
+	strings = PyTuple_New(n);
+	if (strings == NULL)
+		return(NULL);
+
+	for (i = 0; i < n; ++i)
+	{
+		const char *s = c->string_data.data() + c->string_offsets[i];
+		PyObject *str = string(StringRef(s));
+
+		if (str == NULL)
+		{
+			Py_DECREF(strings);
+			return(NULL);
+		}
+
+		PyTuple_SET_ITEM(strings, i, str);
+	}
+
+	for (const auto &s : c->sections)
+	{
+		file.push_back(s.file);
+		function.push_back(s.function);
+		start.push_back(s.start);
+		rows.push_back(s.rows);
+	}
+
+	arrays[0] = array_create(file);
+	arrays[1] = array_create(function);
+	arrays[2] = array_create(start);
+	arrays[3] = array_create(rows);
+	arrays[4] = array_create(c->count);
+	arrays[5] = array_create(c->line);
+	arrays[6] = array_create(c->column);
+	arrays[7] = array_create(c->end_line);
+	arrays[8] = array_create(c->end_column);
+	arrays[9] = array_create(c->kind);
+
+	/* Release the arrays already created when a later one fails. */
+	for (i = 0; i < 10; ++i)
+	{
+		if (arrays[i] == NULL)
+		{
+			for (size_t j = 0; j < 10; ++j)
+				Py_XDECREF(arrays[j]);
+			Py_DECREF(strings);
+			return(NULL);
+		}
+	}
+
+	d = Py_BuildValue("{sN sN sN sN sN sN sN sN sN sN sN}",
+		"strings", strings,
+		"section_file", arrays[0],
+		"section_function", arrays[1],
+		"section_start", arrays[2],
+		"section_rows", arrays[3],
+		"count", arrays[4],
+		"line", arrays[5],
+		"column", arrays[6],
+		"end_line", arrays[7],
+		"end_column", arrays[8],
+		"kind", arrays[9]);
+
+	return(d);
+}
+
+PyDoc_STRVAR(sources_doc,
+	"sources(architecture, images)\n\n"
+	"Return the sorted tuple of source files referenced by the coverage mappings of the images.");
+
+static PyObject *
+module_sources(PyObject *self, PyObject *args)
+{
+	struct Arguments a;
+	StringSet<> paths;
+	std::vector<StringRef> sorted;
+	PyObject *r;
+	int status;
+
+	if (arguments(args, &a, false) != 0)
+		return(NULL);
+
+	Py_BEGIN_ALLOW_THREADS
+	{
+		std::lock_guard<std::mutex> l(module_lock);
+
+		status = read_records(a.arch, a.images.size(), a.images.data(),
+			[&](int, const coverage::CoverageMappingRecord &record) {
+				sources_record(paths, record);
+			});
+	}
+	Py_END_ALLOW_THREADS
+
+	if (status != 0)
+		return(query_failed("sources"));
+
+	for (const auto &entry : paths)
+		sorted.push_back(entry.getKey());
+	std::sort(sorted.begin(), sorted.end());
+
+	r = PyTuple_New(sorted.size());
+	if (r == NULL)
+		return(NULL);
+
+	for (size_t i = 0; i < sorted.size(); ++i)
+	{
+		PyObject *str = string(sorted[i]);
+
+		if (str == NULL)
+		{
+			Py_DECREF(r);
+			return(NULL);
+		}
+
+		PyTuple_SET_ITEM(r, i, str);
+	}
+
+	return(r);
+}
+
+PyDoc_STRVAR(regions_doc,
+	"regions(architecture, images)\n\n"
+	"Return the regions of the functions mapped by the images as a dictionary of columns.\n"
+	"Sections identify the file and function strings of consecutive rows; the count\n"
+	"column of expansion regions holds the string index of the expanded file.");
+
+static PyObject *
+module_regions(PyObject *self, PyObject *args)
+{
+	struct Arguments a;
+	struct Regions rs;
+	int status;
+
+	if (arguments(args, &a, false) != 0)
+		return(NULL);
+
+	Py_BEGIN_ALLOW_THREADS
+	{
+		std::lock_guard<std::mutex> l(module_lock);
+		enum Format format = options.format;
+		int last = -1;
+
+		options.format = format_binary;
+		status = read_records(a.arch, a.images.size(), a.images.data(),
+			[&](int, const coverage::CoverageMappingRecord &record) {
+				regions_record(&rs, record, &last);
+			});
+		options.format = format;
+	}
+	Py_END_ALLOW_THREADS
+
+	if (status != 0)
+		return(query_failed("regions"));
+
+	return(columns_object(&rs.columns));
+}
+
+PyDoc_STRVAR(counters_doc,
+	"counters(architecture, images, profile)\n\n"
+	"Return the counted region entries of the source files as a dictionary of columns.\n"
+	"Every section is a file and the rows are the line, column, and count of the entries.");
+
+static PyObject *
+module_counters(PyObject *self, PyObject *args)
+{
+	struct Arguments a;
+	struct Columns columns;
+	int status = 0;
+
+	if (arguments(args, &a, true) != 0)
+		return(NULL);
+
+	Py_BEGIN_ALLOW_THREADS
+	{
+		std::lock_guard<std::mutex> l(module_lock);
+		auto coverage = load_mapping(a.arch, a.images.size(), a.images.data(), a.datafile);
+
+		if (coverage)
+			columns_counters(&columns, *coverage);
+		else
+			status = 1;
+	}
+	Py_END_ALLOW_THREADS
+
+	if (status != 0)
+		return(query_failed("counters"));
+
+	return(columns_object(&columns));
+}
+
+static PyMethodDef module_methods[] = {
+	{"sources", module_sources, METH_VARARGS, sources_doc},
+	{"regions", module_regions, METH_VARARGS, regions_doc},
+	{"counters", module_counters, METH_VARARGS, counters_doc},
+	{NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT,
+	"ipq",
+	"Coverage mapping and profile queries of LLVM instrumented images.",
+	-1,
+	module_methods,
+};
+
+PyMODINIT_FUNC
+PyInit_ipq(void)
+{
+	PyObject *mod;
+
+	array_type.tp_basicsize = sizeof(struct Array);
+	array_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	array_type.tp_doc = "One dimensional column supporting the buffer protocol.";
+	array_type.tp_dealloc = array_dealloc;
+	array_type.tp_as_sequence = &array_sequence;
+	array_type.tp_as_buffer = &array_buffer;
+
+	if (PyType_Ready(&array_type) < 0)
+		return(NULL);
+
+	mod = PyModule_Create(&module);
+	if (mod == NULL)
+		return(NULL);
+
+	Py_INCREF(&array_type);
+	if (PyModule_AddObject(mod, "Array", (PyObject *) &array_type) < 0)
+	{
+		Py_DECREF(&array_type);
+		Py_DECREF(mod);
+		return(NULL);
+	}
+
+	return(mod);
+}